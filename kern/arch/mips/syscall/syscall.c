@@ -84,6 +84,7 @@ syscall(struct trapframe *tf)
 	int32_t retval;
 	int32_t retval2;
 	int waitcode;
+	off_t pos64;
 	int err;
 
 
@@ -136,6 +137,58 @@ syscall(struct trapframe *tf)
 			err = sys_write((int) tf->tf_a0, (const void*) tf->tf_a1, (size_t) tf->tf_a2, &retval);
 			break;
 
+		case SYS_pipe:
+			err = sys_pipe((userptr_t)tf->tf_a0, &retval);
+			break;
+
+		case SYS_poll:
+			err = sys_poll((userptr_t)tf->tf_a0, (unsigned)tf->tf_a1,
+				       (int)tf->tf_a2, &retval);
+			break;
+
+		case SYS_select: ;
+			// readfds, writefds, exceptfds in a1-a3; the timeout is on the stack
+			userptr_t sets[3] = {
+				(userptr_t)tf->tf_a1, (userptr_t)tf->tf_a2, (userptr_t)tf->tf_a3
+			};
+			userptr_t seltimeout;
+			err = copyin((const_userptr_t)(tf->tf_sp + 16), &seltimeout, sizeof(seltimeout));
+			if (err) {
+				break;
+			}
+			err = sys_select((int)tf->tf_a0, sets, seltimeout, &retval);
+			break;
+
+		case SYS_ioring_enter:
+			err = sys_ioring_enter((userptr_t)tf->tf_a0, (unsigned)tf->tf_a1, &retval);
+			break;
+
+		case SYS_readv:
+			err = sys_readv((int)tf->tf_a0, (const struct iovec *)tf->tf_a1,
+					(int)tf->tf_a2, &retval);
+			break;
+
+		case SYS_writev:
+			err = sys_writev((int)tf->tf_a0, (const struct iovec *)tf->tf_a1,
+					 (int)tf->tf_a2, &retval);
+			break;
+
+		case SYS_pread:
+		case SYS_pwrite:
+			// The 64-bit offset is aligned past a3, onto the stack
+			err = copyin((const_userptr_t)(tf->tf_sp + 16), &pos64, sizeof(off_t));
+			if (err) {
+				break;
+			}
+			if (callno == SYS_pread) {
+				err = sys_pread((int)tf->tf_a0, (void *)tf->tf_a1,
+						(size_t)tf->tf_a2, pos64, &retval);
+			} else {
+				err = sys_pwrite((int)tf->tf_a0, (const void *)tf->tf_a1,
+						 (size_t)tf->tf_a2, pos64, &retval);
+			}
+			break;
+
 		case SYS_lseek: ;
 			int whence = 0;
 			copyin((const_userptr_t) tf->tf_sp + 16, &whence, sizeof(int));
@@ -159,6 +212,10 @@ syscall(struct trapframe *tf)
 			err = sys_fork(tf, &retval);
 			break;
 
+		case SYS_vfork:
+			err = sys_vfork(tf, &retval);
+			break;
+
 		case SYS_getpid:
 			retval = sys_getpid();
 			if (retval > 0) {err = 0;}
@@ -177,10 +234,18 @@ syscall(struct trapframe *tf)
 			break;
 
 		case SYS_execv:
-			sys_execv((const char*)tf->tf_a0, (char **)tf->tf_a1, &retval);
+		case SYS_execve:
+			// Plain execv passes no environment
+			sys_execv((const char*)tf->tf_a0, (char **)tf->tf_a1,
+				  callno == SYS_execve ? (char **)tf->tf_a2 : NULL, &retval);
 			err = retval;
 			break;
 		
+		case SYS_spawn:
+			err = sys_spawn((const char*)tf->tf_a0, (char **)tf->tf_a1,
+					(const int *)tf->tf_a2, (int)tf->tf_a3, &retval);
+			break;
+
 		case SYS_sbrk:
 			err = (int)sys_sbrk((intptr_t)tf->tf_a0, &retval);
 			if(retval == 0){
@@ -190,6 +255,15 @@ syscall(struct trapframe *tf)
 				err = retval;
 			}
 			break;
+
+		case SYS_setaffinity:
+			err = sys_setaffinity((pid_t)tf->tf_a0, (unsigned)tf->tf_a1);
+			break;
+
+		case SYS_getaffinity:
+			err = sys_getaffinity((pid_t)tf->tf_a0, (unsigned *)tf->tf_a1);
+			break;
+
 		default:
 			kprintf("Unknown syscall %d\n", callno);
 			err = ENOSYS;
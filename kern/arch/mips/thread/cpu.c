@@ -140,6 +140,18 @@ cpu_getifeatures(void)
 	return features;
 }
 
+/*
+ * c0_count ($9) counts cpu cycles.
+ */
+uint32_t
+cpu_getcycles(void)
+{
+	uint32_t count;
+
+	__asm volatile("mfc0 %0,$9" : "=r" (count));
+	return count;
+}
+
 void
 cpu_identify(char *buf, size_t max)
 {
@@ -58,6 +58,7 @@
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
+#include <kern/poll.h>
 #include "autoconf.h"
 
 /*
@@ -174,6 +175,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 
 	V(cs->cs_rsem);
+	pollq_wakeup(&cs->cs_pollq);
 }
 
 /*
@@ -302,10 +304,34 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Readable once a character has come in. Output is never held up for
+ * long, so we always call it writable.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct pollent *pe)
+{
+	struct con_softc *cs = dev->d_data;
+	int revents;
+
+	/* Register before looking, so a character right after still wakes */
+	if (pe != NULL) {
+		pollq_register(&cs->cs_pollq, pe);
+	}
+
+	revents = events & POLLOUT;
+	if (cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		revents |= events & POLLIN;
+	}
+	return revents;
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -386,6 +412,7 @@ config_con(struct con_softc *cs, int unit)
 	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	pollq_init(&cs->cs_pollq);
 
 	the_console = cs;
 	con_userlock_read = rlk;
@@ -33,10 +33,12 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/ioctl.h>
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -57,6 +59,12 @@
 #define LHD_ISWRITE     2   /* OR with above: I/O is a write */
 #define LHD_STATEMASK   0x1d  /* mask for masking out LHD_ISWRITE */
 
+/*
+ * Under IOCTL_SCHED_CLOOK, a request passed over by this many others
+ * started after it goes next regardless.
+ */
+#define LHD_DEADLINE    64
+
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
@@ -96,28 +104,170 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the sector the current request is at. Call with lh_lock held.
  */
 static
 void
+lhd_start(struct lhd_softc *lh)
+{
+	struct bio *bio = lh->lh_cur;
+	uint32_t statval = LHD_WORKING;
+
+	/* If writing, transfer the data to the on-card buffer. */
+	if (bio->bio_rw == UIO_WRITE) {
+		memcpy(lh->lh_buf,
+		       (char *)bio->bio_iov[lh->lh_iov].iov_kbase + lh->lh_iovoff,
+		       LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, lh->lh_sect);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Choose the next request to start, and take it off the queue.
+ *
+ * IOCTL_SCHED_FIFO takes the oldest. IOCTL_SCHED_CLOOK is the one-way
+ * elevator: the lowest-numbered request at or past where the disk
+ * finished last, or if there are none, the lowest of all, sweeping
+ * the disk in one direction only. Requests for the next sectors on
+ * from the last one therefore go straight after it, with no seek
+ * between, and each pass over the disk is sorted. The oldest request
+ * goes first anyway once LHD_DEADLINE others have gone ahead of it,
+ * so a stream of I/O at one end of the disk can't hold up the rest
+ * for ever.
+ */
+static
+struct bio *
+lhd_pick(struct lhd_softc *lh)
+{
+	struct bio *bio, *prev;
+	struct bio *best, *bestprev, *low, *lowprev;
+
+	bio = lh->lh_head;
+	if (bio == NULL) {
+		return NULL;
+	}
+
+	best = low = bio;
+	bestprev = lowprev = NULL;
+	if (lh->lh_sched == IOCTL_SCHED_CLOOK &&
+	    lh->lh_seq - bio->bio_stamp < LHD_DEADLINE) {
+		best = NULL;
+		for (prev = NULL; bio != NULL; prev = bio, bio = bio->bio_next) {
+			if (bio->bio_block < low->bio_block) {
+				low = bio;
+				lowprev = prev;
+			}
+			if (bio->bio_block >= lh->lh_sect &&
+			    (best == NULL || bio->bio_block < best->bio_block)) {
+				best = bio;
+				bestprev = prev;
+			}
+		}
+		if (best == NULL) {
+			/* Nothing further on; back to the start */
+			best = low;
+			bestprev = lowprev;
+		}
+	}
+
+	if (bestprev != NULL) {
+		bestprev->bio_next = best->bio_next;
+	}
+	else {
+		lh->lh_head = best->bio_next;
+	}
+	if (lh->lh_tail == best) {
+		lh->lh_tail = bestprev;
+	}
+	best->bio_next = NULL;
+	return best;
+}
+
+/*
+ * If the disk is idle, start the next request. Call with lh_lock held.
+ */
+static
+void
+lhd_next(struct lhd_softc *lh)
+{
+	if (lh->lh_cur != NULL) {
+		return;
+	}
+	lh->lh_cur = lhd_pick(lh);
+	if (lh->lh_cur == NULL) {
+		return;
+	}
+	lh->lh_seq++;
+	lh->lh_iov = 0;
+	lh->lh_iovoff = 0;
+	lh->lh_sect = lh->lh_cur->bio_block;
+	lhd_start(lh);
+}
+
+/*
+ * Record that a sector has completed with result ERR, and keep the
+ * disk going: on to the next sector of the request, or the next
+ * request. Returns the request if it's finished, for the caller to
+ * complete once it has let go of lh_lock.
+ */
+static
+struct bio *
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct bio *bio = lh->lh_cur;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+	KASSERT(bio != NULL);
+
+	/* If reading, transfer the data out of the on-card buffer. */
+	if (err == 0 && bio->bio_rw == UIO_READ) {
+		membar_load_load();
+		memcpy((char *)bio->bio_iov[lh->lh_iov].iov_kbase + lh->lh_iovoff,
+		       lh->lh_buf, LHD_SECTSIZE);
+	}
+
+	if (err == 0) {
+		lh->lh_sect++;
+		lh->lh_iovoff += LHD_SECTSIZE;
+		if (lh->lh_iovoff == bio->bio_iov[lh->lh_iov].iov_len) {
+			lh->lh_iov++;
+			lh->lh_iovoff = 0;
+		}
+		if (lh->lh_iov < bio->bio_iovcnt) {
+			lhd_start(lh);
+			return NULL;
+		}
+	}
+
+	/* This one's over, on success or the first error */
+	bio->bio_error = err;
+	lh->lh_cur = NULL;
+
+	lhd_next(lh);
+	return bio;
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register, start the next one, and report completion.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct bio *done = NULL;
 	uint32_t val;
 
+	spinlock_acquire(&lh->lh_lock);
+
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
@@ -128,9 +278,15 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		done = lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
 	}
+
+	spinlock_release(&lh->lh_lock);
+
+	if (done != NULL) {
+		done->bio_done(done);
+	}
 }
 
 /*
@@ -156,12 +312,19 @@ static
 int
 lhd_ioctl(struct device *d, int op, userptr_t data)
 {
-	/*
-	 * We don't support any ioctls.
-	 */
-	(void)d;
-	(void)op;
+	struct lhd_softc *lh = d->d_data;
+
 	(void)data;
+
+	switch (op) {
+	    case IOCTL_SCHED_FIFO:
+	    case IOCTL_SCHED_CLOOK:
+		/* Takes effect from the next request picked */
+		spinlock_acquire(&lh->lh_lock);
+		lh->lh_sched = op;
+		spinlock_release(&lh->lh_lock);
+		return 0;
+	}
 	return EIOCTL;
 }
 
@@ -180,7 +343,82 @@ lhd_reset(struct lhd_softc *lh)
 #endif
 
 /*
- * I/O function (for both reads and writes)
+ * Queue a request. Each request, and each sector of it, is started
+ * from the interrupt handler as soon as the one before it is done;
+ * which request goes next is up to lhd_pick.
+ */
+static
+int
+lhd_strategy(struct device *d, struct bio *bio)
+{
+	struct lhd_softc *lh = d->d_data;
+	uint32_t len = 0;
+	unsigned i;
+
+	/* Don't allow I/O that isn't in whole sectors. */
+	for (i=0; i<bio->bio_iovcnt; i++) {
+		if (bio->bio_iov[i].iov_len == 0 ||
+		    bio->bio_iov[i].iov_len % LHD_SECTSIZE != 0) {
+			return EINVAL;
+		}
+		len += bio->bio_iov[i].iov_len / LHD_SECTSIZE;
+	}
+	if (len == 0) {
+		return EINVAL;
+	}
+
+	/* Don't allow I/O past the end of the disk. */
+	if (bio->bio_block >= lh->lh_dev.d_blocks ||
+	    len > lh->lh_dev.d_blocks - bio->bio_block) {
+		return EINVAL;
+	}
+
+	bio->bio_error = 0;
+	bio->bio_next = NULL;
+
+	spinlock_acquire(&lh->lh_lock);
+	bio->bio_stamp = lh->lh_seq;
+	if (lh->lh_tail != NULL) {
+		lh->lh_tail->bio_next = bio;
+	}
+	else {
+		lh->lh_head = bio;
+	}
+	lh->lh_tail = bio;
+	lhd_next(lh);
+	spinlock_release(&lh->lh_lock);
+
+	return 0;
+}
+
+/*
+ * Waiting for a request in lhd_io.
+ */
+struct lhd_wait {
+	struct lhd_softc *lw_lh;
+	bool lw_done;
+};
+
+static
+void
+lhd_wakeup(struct bio *bio)
+{
+	struct lhd_wait *lw = bio->bio_data;
+	struct lhd_softc *lh = lw->lw_lh;
+
+	spinlock_acquire(&lh->lh_lock);
+	lw->lw_done = true;
+	wchan_wakeall(lh->lh_wchan, &lh->lh_lock);
+	spinlock_release(&lh->lh_lock);
+}
+
+/* Most sectors lhd_io moves per request */
+#define LHD_IOCHUNK 8
+
+/*
+ * I/O function (for both reads and writes). Goes through the request
+ * queue, LHD_IOCHUNK sectors at a time, bouncing the data through a
+ * kernel buffer since the uio may be in user space.
  */
 static
 int
@@ -192,9 +430,12 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
+	struct lhd_wait lw;
+	struct iovec iov;
+	struct bio bio;
+	char *bounce;
+	uint32_t n;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -207,67 +448,72 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	bounce = kmalloc(LHD_IOCHUNK * LHD_SECTSIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	lw.lw_lh = lh;
+	bio.bio_iov = &iov;
+	bio.bio_iovcnt = 1;
+	bio.bio_rw = uio->uio_rw;
+	bio.bio_done = lhd_wakeup;
+	bio.bio_data = &lw;
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	while (len > 0) {
+		n = len < LHD_IOCHUNK ? len : LHD_IOCHUNK;
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
+		/* Are we writing? If so, collect the data. */
 		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
+		iov.iov_kbase = bounce;
+		iov.iov_len = n * LHD_SECTSIZE;
+		bio.bio_block = sector;
+		lw.lw_done = false;
 
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
+		result = lhd_strategy(d, &bio);
+		if (result) {
+			break;
+		}
 
 		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		spinlock_acquire(&lh->lh_lock);
+		while (!lw.lw_done) {
+			wchan_sleep(lh->lh_wchan, &lh->lh_lock);
 		}
+		spinlock_release(&lh->lh_lock);
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		result = bio.bio_error;
 		if (result) {
-			return result;
+			break;
 		}
+
+		/* Are we reading? If so, hand over the data. */
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
+		}
+
+		sector += n;
+		len -= n;
 	}
 
-	return 0;
+	kfree(bounce);
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_strategy = lhd_strategy,
 };
 
 /*
@@ -284,15 +530,16 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_cur = NULL;
+	lh->lh_head = lh->lh_tail = NULL;
+	lh->lh_sched = IOCTL_SCHED_CLOOK;
+	lh->lh_seq = 0;
+	lh->lh_sect = 0;
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
 
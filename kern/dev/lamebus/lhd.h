@@ -30,6 +30,7 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
 
 /*
@@ -51,9 +52,16 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the request queue */
+	struct bio *lh_cur;		/* Request the disk is working on */
+	struct bio *lh_head;		/* Waiting requests, oldest first */
+	struct bio *lh_tail;
+	int lh_sched;			/* How to pick from them (IOCTL_SCHED_*) */
+	unsigned lh_seq;		/* Requests started so far */
+	unsigned lh_iov;		/* Where lh_cur is at: */
+	size_t lh_iovoff;		/*   which piece of its data, */
+	uint32_t lh_sect;		/*   and which sector */
+	struct wchan *lh_wchan;		/* Synchronous I/O waits here */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -33,11 +33,37 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <buf.h>
+#include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Where blocks go.
+ *
+ * The volume is divided into allocation groups of SFS_GROUPBLOCKS
+ * blocks, with a count of free blocks kept for each. Blocks are
+ * allocated as close as possible after a goal block, searching up the
+ * disk from there and wrapping around at the end: a new file's inode
+ * goes near its directory's (or at the start of the emptiest group,
+ * if the directory's group is nearly full), a file's first block goes
+ * after its inode, and every other block goes after the one before
+ * it in the file.
+ *
+ * So that files written at the same time don't interleave their
+ * blocks, a growing regular file also takes a preallocation window:
+ * up to SFS_PREALLOC free blocks straight after each block it gets
+ * from the freemap, which its next blocks come from as long as it
+ * keeps writing in order. The window is marked in use but isn't part
+ * of the file. It goes back to the freemap when the file is written
+ * out of order, truncated, or reclaimed, or when the disk is otherwise
+ * full; after a crash, sfsck finds whatever was left in one unused and
+ * frees it.
+ */
+
 /*
  * Zero out a disk block.
  */
@@ -52,14 +78,65 @@ sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 }
 
 /*
- * Allocate a block.
+ * Count the free blocks in each allocation group, at mount time.
+ */
+int
+sfs_groupinit(struct sfs_fs *sfs)
+{
+	uint32_t nblocks = sfs->sfs_sb.sb_nblocks;
+	daddr_t block;
+
+	sfs->sfs_ngroups = DIVROUNDUP(nblocks, SFS_GROUPBLOCKS);
+	sfs->sfs_groupfree = kmalloc(sfs->sfs_ngroups *
+				     sizeof(sfs->sfs_groupfree[0]));
+	if (sfs->sfs_groupfree == NULL) {
+		return ENOMEM;
+	}
+	bzero(sfs->sfs_groupfree,
+	      sfs->sfs_ngroups * sizeof(sfs->sfs_groupfree[0]));
+
+	for (block=0; block<nblocks; block++) {
+		if (!bitmap_isset(sfs->sfs_freemap, block)) {
+			sfs->sfs_groupfree[block / SFS_GROUPBLOCKS]++;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Give back the preallocation windows of all loaded vnodes.
+ */
+static
+void
+sfs_prealloc_reclaim(struct sfs_fs *sfs)
+{
+	struct vnode *v;
+	unsigned i, num;
+
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num; i++) {
+		v = vnodearray_get(sfs->sfs_vnodes, i);
+		sfs_prealloc_discard(v->vn_data);
+	}
+}
+
+/*
+ * Take the first free block at or after GOAL (wrapping around), and
+ * mark it in use, but don't clear it. If there are none, the disk may
+ * only be full of other files' preallocation windows; take those back
+ * and try again.
  */
+static
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_bfind(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	result = bitmap_alloc_from(sfs->sfs_freemap, goal, diskblock);
+	if (result == ENOSPC) {
+		sfs_prealloc_reclaim(sfs);
+		result = bitmap_alloc_from(sfs->sfs_freemap, goal, diskblock);
+	}
 	if (result) {
 		return result;
 	}
@@ -68,23 +145,144 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
+	sfs->sfs_groupfree[*diskblock / SFS_GROUPBLOCKS]--;
+	return 0;
+}
+
+/*
+ * Give back a block that was marked in use but never used.
+ */
+static
+void
+sfs_bunmark(struct sfs_fs *sfs, daddr_t diskblock)
+{
+	bitmap_unmark(sfs->sfs_freemap, diskblock);
+	sfs->sfs_freemapdirty = true;
+	sfs->sfs_groupfree[diskblock / SFS_GROUPBLOCKS]++;
+}
+
+/*
+ * Allocate a block, as close after GOAL as there is one.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
+{
+	int result;
+
+	result = sfs_bfind(sfs, goal, diskblock);
+	if (result) {
+		return result;
+	}
 
 	/* Clear block before returning it */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
-		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs_bunmark(sfs, *diskblock);
 	}
 	return result;
 }
 
 /*
- * Free a block.
+ * Give back what's left of SV's preallocation window.
+ */
+void
+sfs_prealloc_discard(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	while (sv->sv_palen > 0) {
+		sfs_bunmark(sfs, sv->sv_pastart);
+		sv->sv_pastart++;
+		sv->sv_palen--;
+	}
+}
+
+/*
+ * Allocate a block for file SV, which wants it at GOAL: from its
+ * preallocation window if that starts there, or else as close after
+ * GOAL as there is one, opening a new window after it.
+ */
+int
+sfs_balloc_file(struct sfs_vnode *sv, daddr_t goal, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block;
+	int result;
+
+	if (sv->sv_palen > 0 && sv->sv_pastart == goal) {
+		block = sv->sv_pastart;
+		sv->sv_pastart++;
+		sv->sv_palen--;
+	}
+	else {
+		sfs_prealloc_discard(sv);
+
+		result = sfs_bfind(sfs, goal, &block);
+		if (result) {
+			return result;
+		}
+
+		if (sv->sv_i.sfi_type == SFS_TYPE_FILE) {
+			sv->sv_pastart = block + 1;
+			while (sv->sv_palen < SFS_PREALLOC &&
+			       sv->sv_pastart + sv->sv_palen <
+			       sfs->sfs_sb.sb_nblocks &&
+			       !bitmap_isset(sfs->sfs_freemap,
+					     sv->sv_pastart + sv->sv_palen)) {
+				bitmap_mark(sfs->sfs_freemap,
+					    sv->sv_pastart + sv->sv_palen);
+				sfs->sfs_groupfree[(sv->sv_pastart +
+						    sv->sv_palen) /
+						   SFS_GROUPBLOCKS]--;
+				sv->sv_palen++;
+			}
+		}
+	}
+
+	/* Clear block before returning it */
+	result = sfs_clearblock(sfs, block);
+	if (result) {
+		sfs_bunmark(sfs, block);
+		return result;
+	}
+	*diskblock = block;
+	return 0;
+}
+
+/*
+ * Where to put a new inode, given the inode of its directory: right
+ * after it, unless its group is nearly full; then at the start of
+ * whichever group has the most free blocks.
+ */
+daddr_t
+sfs_inodegoal(struct sfs_fs *sfs, uint32_t dirino)
+{
+	unsigned g, best;
+
+	g = dirino / SFS_GROUPBLOCKS;
+	if (g < sfs->sfs_ngroups &&
+	    sfs->sfs_groupfree[g] >= SFS_GROUP_MINFREE) {
+		return dirino + 1;
+	}
+
+	best = 0;
+	for (g=1; g<sfs->sfs_ngroups; g++) {
+		if (sfs->sfs_groupfree[g] > sfs->sfs_groupfree[best]) {
+			best = g;
+		}
+	}
+	return best * SFS_GROUPBLOCKS;
+}
+
+/*
+ * Free a block. Whatever the cache holds for it is garbage now; drop
+ * it rather than write it back.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
-	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	buffer_drop(sfs->sfs_device, diskblock);
+	sfs_bunmark(sfs, diskblock);
 }
 
 /*
@@ -99,4 +297,3 @@ sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 	}
 	return bitmap_isset(sfs->sfs_freemap, diskblock);
 }
-
@@ -36,53 +36,298 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Look up the disk block number (from 0 up to the number of blocks on
- * the disk) given a file and the logical block number within that
- * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * A file's blocks are found through, in order:
+ *
+ *    - its extents, on a volume with SFS_FEATURE_EXTENTS;
+ *    - SFS_NDIRECT direct block numbers in the inode;
+ *    - the indirect block, which holds SFS_DBPERIDB block numbers;
+ *    - the double indirect block, which holds the block numbers of
+ *      SFS_DBPERIDB indirect blocks;
+ *    - and the triple indirect block, likewise one level further.
+ *
+ * The direct and indirect blocks cover file blocks one after another
+ * from 0, as if the extents weren't there. A block in an extent is
+ * never also in them, so the extents are just checked first.
  */
-int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+
+static
+bool
+sfs_hasextents(struct sfs_vnode *sv)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	return (sfs->sfs_sb.sb_features & SFS_FEATURE_EXTENTS) != 0;
+}
+
+/*
+ * Number of file blocks mapped by each entry of an indirect block
+ * LEVELS deep (1 for an indirect block, 2 for a double indirect...).
+ */
+static
+uint32_t
+sfs_indirspan(unsigned levels)
+{
+	uint32_t span = 1;
+
+	while (levels > 1) {
+		span *= SFS_DBPERIDB;
+		levels--;
+	}
+	return span;
+}
+
+/*
+ * Where in the inode the number of the top indirect block LEVELS deep
+ * is kept.
+ */
+static
+uint32_t *
+sfs_indirtop(struct sfs_vnode *sv, unsigned levels)
+{
+	switch (levels) {
+	    case 1: return &sv->sv_i.sfi_indirect;
+	    case 2: return &sv->sv_i.sfi_dindirect;
+	    case 3: return &sv->sv_i.sfi_tindirect;
+	}
+	panic("sfs: no indirect block %u levels deep\n", levels);
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Extents
 
+/*
+ * Find FILEBLOCK in the extents of SV. Returns its disk block, or 0
+ * if it's not there.
+ */
+static
+daddr_t
+sfs_extent_lookup(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	struct sfs_extent *ext;
+	unsigned i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sv->sv_i.sfi_extents[i];
+		if (ext->sfe_len == 0 || ext->sfe_fileblock > fileblock) {
+			break;
+		}
+		if (fileblock - ext->sfe_fileblock < ext->sfe_len) {
+			return ext->sfe_diskblock +
+				(fileblock - ext->sfe_fileblock);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Allocate a block for FILEBLOCK, which isn't mapped anywhere yet, in
+ * the extents of SV, trying for GOAL: on the end of the extent just
+ * before it, if that ends right there and the block after it on disk
+ * is what we get, or else as a new extent. Hands back 0 if that would
+ * take a new extent and they're all in use.
+ */
+static
+int
+sfs_extent_alloc(struct sfs_vnode *sv, uint32_t fileblock, daddr_t goal,
+		 daddr_t *diskblock)
+{
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_extent *exts = sv->sv_i.sfi_extents;
+	struct sfs_extent *prev = NULL;
+	bool room;
 	daddr_t block;
-	daddr_t idblock;
-	uint32_t idnum, idoff;
+	unsigned i, pos;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	/* Find where it goes */
+	for (pos=0; pos<SFS_NEXTENTS; pos++) {
+		if (exts[pos].sfe_len == 0 ||
+		    exts[pos].sfe_fileblock > fileblock) {
+			break;
+		}
+	}
 
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	if (pos > 0 &&
+	    exts[pos-1].sfe_fileblock + exts[pos-1].sfe_len == fileblock) {
+		prev = &exts[pos-1];
+		goal = prev->sfe_diskblock + prev->sfe_len;
+	}
+	room = exts[SFS_NEXTENTS-1].sfe_len == 0;
+	if (prev == NULL && !room) {
+		*diskblock = 0;
+		return 0;
+	}
+
+	result = sfs_balloc_file(sv, goal, &block);
+	if (result) {
+		return result;
+	}
+
+	if (prev != NULL && block == goal) {
+		prev->sfe_len++;
+	}
+	else if (room) {
+		for (i=SFS_NEXTENTS-1; i>pos; i--) {
+			exts[i] = exts[i-1];
+		}
+		exts[pos].sfe_fileblock = fileblock;
+		exts[pos].sfe_diskblock = block;
+		exts[pos].sfe_len = 1;
+	}
+	else {
+		/* It didn't land where it would fit; let someone else try */
+		sfs_bfree(sfs, block);
+		*diskblock = 0;
+		return 0;
+	}
+	sv->sv_dirty = true;
+
+	*diskblock = block;
+	return 0;
+}
+
+/*
+ * Free the blocks in the extents of SV from file block BLOCKLEN on.
+ */
+static
+void
+sfs_extent_trunc(struct sfs_vnode *sv, uint32_t blocklen)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_extent *ext;
+	uint32_t keep, j;
+	unsigned i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sv->sv_i.sfi_extents[i];
+		if (ext->sfe_len == 0) {
+			break;
+		}
+		if (ext->sfe_fileblock >= blocklen) {
+			keep = 0;
+		}
+		else if (blocklen - ext->sfe_fileblock < ext->sfe_len) {
+			keep = blocklen - ext->sfe_fileblock;
+		}
+		else {
+			continue;
+		}
+
+		for (j=keep; j<ext->sfe_len; j++) {
+			sfs_bfree(sfs, ext->sfe_diskblock + j);
+		}
+		if (keep == 0) {
+			/* Extents past it go too, so this stays in order */
+			bzero(ext, sizeof(*ext));
+		}
+		else {
+			ext->sfe_len = keep;
+		}
+		sv->sv_dirty = true;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Direct and indirect blocks
+
+/*
+ * Look up block INDEX of those under the indirect block *TOP, which
+ * is LEVELS deep. If DOALLOC is set, allocate whatever is missing on
+ * the way down, one after another from GOAL.
+ */
+static
+int
+sfs_indirmap(struct sfs_vnode *sv, uint32_t *top, unsigned levels,
+	     uint32_t index, bool doalloc, daddr_t goal, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	uint32_t *entries;
+	uint32_t span;
+	daddr_t block, next;
+	int result;
+
+	block = *top;
+	if (block == 0) {
+		if (!doalloc) {
+			/* Nothing under it; as if it were all zeros */
+			*diskblock = 0;
+			return 0;
+		}
+		result = sfs_balloc_file(sv, goal, &block);
+		if (result) {
+			return result;
+		}
+		*top = block;
+		sv->sv_dirty = true;
+		goal = block + 1;
+	}
+
+	for (; levels > 0; levels--) {
+		span = sfs_indirspan(levels);
+
+		result = buffer_read(sfs->sfs_device, block, &buf);
+		if (result) {
+			return result;
+		}
+		entries = buffer_map(buf);
+
+		next = entries[index / span];
+		if (next == 0 && doalloc) {
+			result = sfs_balloc_file(sv, goal, &next);
+			if (result) {
+				buffer_release(buf);
+				return result;
+			}
+			entries[index / span] = next;
+			buffer_mark_dirty(buf);
+			goal = next + 1;
+		}
+		buffer_release(buf);
+
+		if (next == 0) {
+			*diskblock = 0;
+			return 0;
+		}
+		block = next;
+		index %= span;
+	}
+
+	*diskblock = block;
+	return 0;
+}
+
+/*
+ * Look up FILEBLOCK in the direct and indirect blocks of SV,
+ * allocating it (and any indirect blocks on the way) from GOAL on if
+ * DOALLOC is set.
+ */
+static
+int
+sfs_blockmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	     daddr_t goal, daddr_t *diskblock)
+{
+	daddr_t block;
+	uint32_t range;
+	unsigned levels;
+	int result;
 
 	/*
 	 * If the block we want is one of the direct blocks...
 	 */
 	if (fileblock < SFS_NDIRECT) {
-		/*
-		 * Get the block number
-		 */
 		block = sv->sv_i.sfi_direct[fileblock];
 
-		/*
-		 * Do we need to allocate?
-		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_balloc_file(sv, goal, &block);
 			if (result) {
 				return result;
 			}
@@ -91,98 +336,182 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 			sv->sv_i.sfi_direct[fileblock] = block;
 			sv->sv_dirty = true;
 		}
-
-		/*
-		 * Hand back the block
-		 */
-		if (block != 0 && !sfs_bused(sfs, block)) {
-			panic("sfs: Data block %u (block %u of file %u) "
-			      "marked free\n", block, fileblock, sv->sv_ino);
-		}
 		*diskblock = block;
 		return 0;
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * Otherwise, find which indirect block has it, and where in
+	 * the range that one maps.
 	 */
-
 	fileblock -= SFS_NDIRECT;
+	for (levels=1; levels<=3; levels++) {
+		range = sfs_indirspan(levels) * SFS_DBPERIDB;
+		if (fileblock < range) {
+			return sfs_indirmap(sv, sfs_indirtop(sv, levels),
+					    levels, fileblock, doalloc, goal,
+					    diskblock);
+		}
+		fileblock -= range;
+	}
 
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum >= SFS_NINDIRECT) {
+	/* Past the end of the triple indirect block */
+	if (doalloc) {
 		return EFBIG;
 	}
+	*diskblock = 0;
+	return 0;
+}
+
+/*
+ * Free the blocks past BLOCKLEN under the indirect block *SLOT, which
+ * is LEVELS deep and maps the file blocks from BASE on; then the
+ * indirect block itself, if that leaves it empty.
+ */
+static
+int
+sfs_indirtrunc(struct sfs_vnode *sv, uint32_t *slot, unsigned levels,
+	       uint32_t base, uint32_t blocklen)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
+	uint32_t *entries;
+	uint32_t span, old, i;
+	bool dirty = false, empty = true;
+	int result = 0;
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	if (*slot == 0) {
+		return 0;
+	}
 
-	if (idblock==0 && !doalloc) {
-		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
-		 */
-		*diskblock = 0;
+	span = sfs_indirspan(levels);
+	if (blocklen >= base + span * SFS_DBPERIDB) {
+		/* All of it is before the new EOF */
 		return 0;
 	}
-	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
-		result = sfs_balloc(sfs, &idblock);
-		if (result) {
-			return result;
+
+	result = buffer_read(sfs->sfs_device, *slot, &buf);
+	if (result) {
+		return result;
+	}
+	entries = buffer_map(buf);
+
+	for (i=0; i<SFS_DBPERIDB; i++) {
+		old = entries[i];
+		if (old == 0) {
+			continue;
+		}
+		if (levels > 1) {
+			result = sfs_indirtrunc(sv, &entries[i], levels-1,
+						base + i*span, blocklen);
+			if (result) {
+				break;
+			}
+		}
+		else if (base + i >= blocklen) {
+			sfs_bfree(sfs, old);
+			entries[i] = 0;
 		}
+		if (entries[i] != old) {
+			dirty = true;
+		}
+		if (entries[i] != 0) {
+			empty = false;
+		}
+	}
 
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+	if (dirty) {
+		buffer_mark_dirty(buf);
+	}
+	buffer_release(buf);
+	if (result) {
+		return result;
+	}
 
-		/* Mark the inode dirty */
-		sv->sv_dirty = true;
+	if (empty) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, *slot);
+		*slot = 0;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+/*
+ * Look up FILEBLOCK of SV, without allocating anything.
+ */
+static
+int
+sfs_bmap_lookup(struct sfs_vnode *sv, uint32_t fileblock, daddr_t *diskblock)
+{
+	daddr_t block = 0;
+	int result;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+	if (sfs_hasextents(sv)) {
+		block = sfs_extent_lookup(sv, fileblock);
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+	if (block == 0) {
+		result = sfs_blockmap(sv, fileblock, false, 0, &block);
 		if (result) {
 			return result;
 		}
 	}
+	*diskblock = block;
+	return 0;
+}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+/*
+ * Look up the disk block number (from 0 up to the number of blocks on
+ * the disk) given a file and the logical block number within that
+ * file. If DOALLOC is set, and no such block exists, one will be
+ * allocated: in the extents if possible, and otherwise in the direct
+ * and indirect blocks; on disk, right after the block before it in
+ * the file if that's free, or right after the inode for the first.
+ */
+int
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	 daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block, goal;
+	int result;
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
-			return result;
-		}
+	/* The buffers of indirect blocks are shared; we'd better be locked. */
+	KASSERT(vfs_biglock_do_i_hold());
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+	result = sfs_bmap_lookup(sv, fileblock, &block);
+	if (result) {
+		return result;
+	}
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
+	/*
+	 * Do we need to allocate?
+	 */
+	if (block == 0 && doalloc) {
+		goal = 0;
+		if (fileblock > 0) {
+			result = sfs_bmap_lookup(sv, fileblock - 1, &goal);
+			if (result) {
+				return result;
+			}
+		}
+		goal = (goal != 0 ? goal : sv->sv_ino) + 1;
+
+		if (sfs_hasextents(sv)) {
+			result = sfs_extent_alloc(sv, fileblock, goal, &block);
+			if (result) {
+				return result;
+			}
+		}
+		if (block == 0) {
+			result = sfs_blockmap(sv, fileblock, true, goal,
+					      &block);
+			if (result) {
+				return result;
+			}
 		}
 	}
 
@@ -201,30 +530,24 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
+	uint32_t i, base;
+	unsigned levels;
+	daddr_t block;
 	int result;
-	int hasnonzero, iddirty;
-
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
 
 	vfs_biglock_acquire();
 
+	sfs_prealloc_discard(sv);
+
+	if (sfs_hasextents(sv)) {
+		sfs_extent_trunc(sv, blocklen);
+	}
+
 	/*
 	 * Go through the direct blocks. Discard any that are
 	 * past the limit we're truncating to.
@@ -238,55 +561,16 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+	/* Then whatever's past it under each of the indirect blocks */
+	base = SFS_NDIRECT;
+	for (levels=1; levels<=3; levels++) {
+		result = sfs_indirtrunc(sv, sfs_indirtop(sv, levels), levels,
+					base, blocklen);
 		if (result) {
 			vfs_biglock_release();
 			return result;
 		}
-
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
+		base += sfs_indirspan(levels) * SFS_DBPERIDB;
 	}
 
 	/* Set the file size */
@@ -298,4 +582,3 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	vfs_biglock_release();
 	return 0;
 }
-
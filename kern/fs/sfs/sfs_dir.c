@@ -95,13 +95,279 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 }
 
 /*
- * Search a directory for a particular filename in a directory, and
- * return its inode number, its slot, and/or the slot number of an
- * empty directory slot if one is found.
+ * Name hash.
+ *
+ * Searching a directory used to mean reading every slot in it, so
+ * creating N files in one directory cost O(N^2) entry reads. Instead,
+ * the first time a directory is searched we read it once, a block at
+ * a time, and build an in-memory table from names to slots; it also
+ * remembers the empty slots so sfs_dir_link doesn't have to hunt for
+ * one. sfs_dir_link and sfs_dir_unlink keep the table up to date, and
+ * it is thrown away when the vnode is reclaimed, so the on-disk format
+ * is unchanged.
+ *
+ * The table is only a cache. If it can't be built or updated for
+ * lack of memory it is dropped, and we fall back to scanning the
+ * directory until it can be built again.
+ */
+
+struct sfs_dirhent {
+	struct sfs_dirhent *dhe_next;	/* bucket chain or free list */
+	uint32_t dhe_hash;		/* hash of dhe_name */
+	uint32_t dhe_ino;		/* inode number */
+	int dhe_slot;			/* slot in the directory */
+	char *dhe_name;			/* name; NULL for an empty slot */
+};
+
+struct sfs_dirhash {
+	struct sfs_dirhent **dh_buckets;	/* hash chains */
+	unsigned dh_nbuckets;			/* always a power of 2 */
+	unsigned dh_count;			/* names in the table */
+	struct sfs_dirhent *dh_free;		/* empty slots */
+};
+
+/*
+ * Hash a name (FNV-1a).
+ */
+static
+uint32_t
+sfs_dirhash_name(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Find the chain link pointing at the entry for NAME, which is NULL
+ * if the name isn't there.
  */
+static
+struct sfs_dirhent **
+sfs_dirhash_find(struct sfs_dirhash *dh, const char *name, uint32_t hash)
+{
+	struct sfs_dirhent **pp;
+
+	pp = &dh->dh_buckets[hash & (dh->dh_nbuckets - 1)];
+	while (*pp != NULL) {
+		if ((*pp)->dhe_hash == hash && !strcmp((*pp)->dhe_name, name)) {
+			break;
+		}
+		pp = &(*pp)->dhe_next;
+	}
+	return pp;
+}
+
+/*
+ * Double the number of buckets. Failing to is harmless; the chains
+ * just get longer.
+ */
+static
+void
+sfs_dirhash_grow(struct sfs_dirhash *dh)
+{
+	struct sfs_dirhent **nb, *dhe;
+	unsigned i, n;
+
+	n = dh->dh_nbuckets * 2;
+	nb = kmalloc(n * sizeof(*nb));
+	if (nb == NULL) {
+		return;
+	}
+	for (i=0; i<n; i++) {
+		nb[i] = NULL;
+	}
+	for (i=0; i<dh->dh_nbuckets; i++) {
+		while ((dhe = dh->dh_buckets[i]) != NULL) {
+			dh->dh_buckets[i] = dhe->dhe_next;
+			dhe->dhe_next = nb[dhe->dhe_hash & (n - 1)];
+			nb[dhe->dhe_hash & (n - 1)] = dhe;
+		}
+	}
+	kfree(dh->dh_buckets);
+	dh->dh_buckets = nb;
+	dh->dh_nbuckets = n;
+}
+
+/*
+ * Enter DHE, which is not on any list, under NAME. On failure DHE is
+ * left alone.
+ */
+static
 int
-sfs_dir_findname(struct sfs_vnode *sv, const char *name,
-		uint32_t *ino, int *slot, int *emptyslot)
+sfs_dirhash_insert(struct sfs_dirhash *dh, struct sfs_dirhent *dhe,
+		   const char *name, uint32_t ino, int slot)
+{
+	uint32_t hash;
+
+	dhe->dhe_name = kstrdup(name);
+	if (dhe->dhe_name == NULL) {
+		return ENOMEM;
+	}
+	hash = sfs_dirhash_name(name);
+	dhe->dhe_hash = hash;
+	dhe->dhe_ino = ino;
+	dhe->dhe_slot = slot;
+	dhe->dhe_next = dh->dh_buckets[hash & (dh->dh_nbuckets - 1)];
+	dh->dh_buckets[hash & (dh->dh_nbuckets - 1)] = dhe;
+
+	dh->dh_count++;
+	if (dh->dh_count > 2 * dh->dh_nbuckets) {
+		sfs_dirhash_grow(dh);
+	}
+	return 0;
+}
+
+/*
+ * Add a directory entry read from slot SLOT to the table.
+ */
+static
+int
+sfs_dirhash_add(struct sfs_dirhash *dh, const struct sfs_direntry *sd,
+		int slot)
+{
+	struct sfs_dirhent *dhe;
+	int result;
+
+	dhe = kmalloc(sizeof(*dhe));
+	if (dhe == NULL) {
+		return ENOMEM;
+	}
+
+	if (sd->sfd_ino == SFS_NOINO) {
+		dhe->dhe_name = NULL;
+		dhe->dhe_hash = 0;
+		dhe->dhe_ino = SFS_NOINO;
+		dhe->dhe_slot = slot;
+		dhe->dhe_next = dh->dh_free;
+		dh->dh_free = dhe;
+		return 0;
+	}
+
+	result = sfs_dirhash_insert(dh, dhe, sd->sfd_name, sd->sfd_ino, slot);
+	if (result) {
+		kfree(dhe);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Throw away a directory's name table.
+ */
+void
+sfs_dirhash_destroy(struct sfs_vnode *sv)
+{
+	struct sfs_dirhash *dh = sv->sv_dirhash;
+	struct sfs_dirhent *dhe;
+	unsigned i;
+
+	if (dh == NULL) {
+		return;
+	}
+	sv->sv_dirhash = NULL;
+
+	for (i=0; i<dh->dh_nbuckets; i++) {
+		while ((dhe = dh->dh_buckets[i]) != NULL) {
+			dh->dh_buckets[i] = dhe->dhe_next;
+			kfree(dhe->dhe_name);
+			kfree(dhe);
+		}
+	}
+	while ((dhe = dh->dh_free) != NULL) {
+		dh->dh_free = dhe->dhe_next;
+		kfree(dhe);
+	}
+	kfree(dh->dh_buckets);
+	kfree(dh);
+}
+
+/*
+ * Return the directory's name table, reading the directory to build
+ * it if there isn't one yet.
+ */
+static
+int
+sfs_dirhash_get(struct sfs_vnode *sv, struct sfs_dirhash **ret)
+{
+	const int perblock = SFS_BLOCKSIZE / sizeof(struct sfs_direntry);
+	struct sfs_dirhash *dh;
+	struct sfs_direntry *sds;
+	int nentries, i, j, n, result;
+	unsigned nb;
+
+	if (sv->sv_dirhash != NULL) {
+		*ret = sv->sv_dirhash;
+		return 0;
+	}
+
+	nentries = sfs_dir_nentries(sv);
+	nb = SFS_DIRHASH_MIN;
+	while (nb < (unsigned)nentries) {
+		nb *= 2;
+	}
+
+	dh = kmalloc(sizeof(*dh));
+	if (dh == NULL) {
+		return ENOMEM;
+	}
+	dh->dh_buckets = kmalloc(nb * sizeof(*dh->dh_buckets));
+	if (dh->dh_buckets == NULL) {
+		kfree(dh);
+		return ENOMEM;
+	}
+	for (i=0; i<(int)nb; i++) {
+		dh->dh_buckets[i] = NULL;
+	}
+	dh->dh_nbuckets = nb;
+	dh->dh_count = 0;
+	dh->dh_free = NULL;
+	sv->sv_dirhash = dh;
+
+	sds = kmalloc(SFS_BLOCKSIZE);
+	if (sds == NULL) {
+		sfs_dirhash_destroy(sv);
+		return ENOMEM;
+	}
+
+	/* Read the directory a whole block at a time */
+	result = 0;
+	for (i=0; i<nentries && result == 0; i+=perblock) {
+		n = nentries - i;
+		if (n > perblock) {
+			n = perblock;
+		}
+		result = sfs_metaio(sv, (off_t)i * sizeof(struct sfs_direntry),
+				    sds, n * sizeof(struct sfs_direntry),
+				    UIO_READ);
+		for (j=0; j<n && result == 0; j++) {
+			/* Ensure null termination, just in case */
+			sds[j].sfd_name[sizeof(sds[j].sfd_name)-1] = 0;
+			result = sfs_dirhash_add(dh, &sds[j], i + j);
+		}
+	}
+	kfree(sds);
+
+	if (result) {
+		sfs_dirhash_destroy(sv);
+		return result;
+	}
+	*ret = dh;
+	return 0;
+}
+
+/*
+ * Search a directory by reading every slot. Used when the name table
+ * can't be built.
+ */
+static
+int
+sfs_dir_scan(struct sfs_vnode *sv, const char *name,
+	     uint32_t *ino, int *slot, int *emptyslot)
 {
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
@@ -145,6 +411,44 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	return found ? 0 : ENOENT;
 }
 
+/*
+ * Search a directory for a particular filename in a directory, and
+ * return its inode number, its slot, and/or the slot number of an
+ * empty directory slot if one is found.
+ */
+int
+sfs_dir_findname(struct sfs_vnode *sv, const char *name,
+		uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dirhash *dh;
+	struct sfs_dirhent *dhe;
+	int result;
+
+	result = sfs_dirhash_get(sv, &dh);
+	if (result == ENOMEM) {
+		return sfs_dir_scan(sv, name, ino, slot, emptyslot);
+	}
+	if (result) {
+		return result;
+	}
+
+	if (emptyslot != NULL && dh->dh_free != NULL) {
+		*emptyslot = dh->dh_free->dhe_slot;
+	}
+
+	dhe = *sfs_dirhash_find(dh, name, sfs_dirhash_name(name));
+	if (dhe == NULL) {
+		return ENOENT;
+	}
+	if (slot != NULL) {
+		*slot = dhe->dhe_slot;
+	}
+	if (ino != NULL) {
+		*ino = dhe->dhe_ino;
+	}
+	return 0;
+}
+
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
@@ -155,6 +459,8 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	int emptyslot = -1;
 	int result;
 	struct sfs_direntry sd;
+	struct sfs_dirhash *dh;
+	struct sfs_dirhent **pp, *dhe;
 
 	/* Look up the name. We want to make sure it *doesn't* exist. */
 	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
@@ -185,7 +491,37 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* Enter the name in the table, reusing the empty slot's entry */
+	dh = sv->sv_dirhash;
+	if (dh == NULL) {
+		return 0;
+	}
+	for (pp = &dh->dh_free; *pp != NULL; pp = &(*pp)->dhe_next) {
+		if ((*pp)->dhe_slot == emptyslot) {
+			break;
+		}
+	}
+	dhe = *pp;
+	if (dhe != NULL) {
+		*pp = dhe->dhe_next;
+	}
+	else {
+		dhe = kmalloc(sizeof(*dhe));
+		if (dhe == NULL) {
+			sfs_dirhash_destroy(sv);
+			return 0;
+		}
+	}
+	if (sfs_dirhash_insert(dh, dhe, name, ino, emptyslot)) {
+		kfree(dhe);
+		sfs_dirhash_destroy(sv);
+	}
+	return 0;
 }
 
 /*
@@ -195,13 +531,52 @@ int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
+	struct sfs_dirhash *dh = sv->sv_dirhash;
+	struct sfs_dirhent **pp = NULL, *dhe = NULL;
+	int result;
+
+	/*
+	 * If there's a name table, find out which name is going away.
+	 * The block is in the buffer cache, since the caller just
+	 * looked the name up.
+	 */
+	if (dh != NULL) {
+		result = sfs_readdir(sv, slot, &sd);
+		if (result) {
+			sfs_dirhash_destroy(sv);
+			dh = NULL;
+		}
+	}
+
+	if (dh != NULL) {
+		sd.sfd_name[sizeof(sd.sfd_name)-1] = 0;
+		pp = sfs_dirhash_find(dh, sd.sfd_name,
+				      sfs_dirhash_name(sd.sfd_name));
+		dhe = *pp;
+		KASSERT(dhe != NULL && dhe->dhe_slot == slot);
+	}
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* Move the table entry over to the empty slots */
+	if (dh != NULL) {
+		*pp = dhe->dhe_next;
+		dh->dh_count--;
+		kfree(dhe->dhe_name);
+		dhe->dhe_name = NULL;
+		dhe->dhe_ino = SFS_NOINO;
+		dhe->dhe_next = dh->dh_free;
+		dh->dh_free = dhe;
+	}
+	return 0;
 }
 
 /*
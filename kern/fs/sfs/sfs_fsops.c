@@ -41,6 +41,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -179,6 +180,13 @@ sfs_sync(struct fs *fs)
 		sfs->sfs_superdirty = false;
 	}
 
+	/* Everything above only went as far as the buffer cache. */
+	result = buffer_sync(sfs->sfs_device);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	vfs_biglock_release();
 	return 0;
 }
@@ -212,6 +220,7 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	kfree(sfs->sfs_groupfree);
 	vnodearray_destroy(sfs->sfs_vnodes);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
@@ -227,6 +236,7 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
 	vfs_biglock_acquire();
 
@@ -240,6 +250,13 @@ sfs_unmount(struct fs *fs)
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Flush anything left and empty the device out of the cache */
+	result = buffer_drop_device(sfs->sfs_device);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -310,6 +327,10 @@ sfs_fs_create(void)
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
 
+	/* allocation groups */
+	sfs->sfs_groupfree = NULL;
+	sfs->sfs_ngroups = 0;
+
 	return sfs;
 
 cleanup_object:
@@ -388,6 +409,14 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return EINVAL;
 	}
 
+	if (sfs->sfs_sb.sb_features & ~SFS_FEATURES) {
+		kprintf("sfs: Unknown features in superblock (0x%x)\n",
+			sfs->sfs_sb.sb_features & ~SFS_FEATURES);
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return EINVAL;
+	}
+
 	if (sfs->sfs_sb.sb_nblocks > dev->d_blocks) {
 		kprintf("sfs: warning - fs has %u blocks, device has %u\n",
 			sfs->sfs_sb.sb_nblocks, dev->d_blocks);
@@ -410,6 +439,14 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return result;
 	}
 
+	/* Count what's free where, for the allocator */
+	result = sfs_groupinit(sfs);
+	if (result) {
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
@@ -93,6 +93,12 @@ sfs_reclaim(struct vnode *v)
 	}
 	spinlock_release(&v->vn_countlock);
 
+	/* Nothing more will be written; give back the window */
+	sfs_prealloc_discard(sv);
+
+	/* Drop the directory name table, if any */
+	sfs_dirhash_destroy(sv);
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
@@ -205,6 +211,18 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* No reads yet; one from the start counts as sequential */
+	sv->sv_ralast = 0;
+	sv->sv_raend = 0;
+	sv->sv_rawindow = 0;
+
+	/* Nothing preallocated */
+	sv->sv_pastart = 0;
+	sv->sv_palen = 0;
+
+	/* No name table until the directory is searched */
+	sv->sv_dirhash = NULL;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out by sfs_balloc and
@@ -256,10 +274,12 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 }
 
 /*
- * Create a new filesystem object and hand back its vnode.
+ * Create a new filesystem object, to go in the directory whose inode
+ * is DIRINO, and hand back its vnode.
  */
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, int type, uint32_t dirino,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
@@ -269,7 +289,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, sfs_inodegoal(sfs, dirino), &ino);
 	if (result) {
 		return result;
 	}
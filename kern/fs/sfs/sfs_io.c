@@ -38,6 +38,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -50,67 +51,29 @@
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
  * except sfs_device.
+ *
+ * Both go through the buffer cache: sfs_writeblock only updates the
+ * cached copy, which reaches the disk when it is evicted or on sync.
  */
 
-/*
- * Read or write a block, retrying I/O errors.
- */
-static
-int
-sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
-{
-	int result;
-	int tries=0;
-
-	KASSERT(vfs_biglock_do_i_hold());
-
-	DEBUG(DB_SFS, "sfs: %s %llu\n",
-	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
-
- retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
-	if (result == EINVAL) {
-		/*
-		 * This means the sector we requested was out of range,
-		 * or the seek address we gave wasn't sector-aligned,
-		 * or a couple of other things that are our fault.
-		 */
-		panic("sfs: DEVOP_IO returned EINVAL\n");
-	}
-	if (result == EIO) {
-		if (tries == 0) {
-			tries++;
-			kprintf("sfs: block %llu I/O error, retrying\n",
-				uio->uio_offset / SFS_BLOCKSIZE);
-			goto retry;
-		}
-		else if (tries < 10) {
-			tries++;
-			goto retry;
-		}
-		else {
-			kprintf("sfs: block %llu I/O error, giving up after "
-				"%d retries\n",
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
-		}
-	}
-	return result;
-}
-
 /*
  * Read a block.
  */
 int
 sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct buf *buf;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	result = buffer_read(sfs->sfs_device, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(data, buffer_map(buf), len);
+	buffer_release(buf);
+	return 0;
 }
 
 /*
@@ -119,13 +82,19 @@ sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct buf *buf;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	result = buffer_get(sfs->sfs_device, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(buffer_map(buf), data, len);
+	buffer_mark_dirty(buf);
+	buffer_release(buf);
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
@@ -134,9 +103,9 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
- * need to read in the original block first, even if we're writing, so
- * we don't clobber the portion of the block we're not intending to
- * write over.
+ * need the original block in the buffer cache first, even if we're
+ * writing, so we don't clobber the portion of the block we're not
+ * intending to write over.
  *
  * SKIPSTART is the number of bytes to skip past at the beginning of
  * the sector; LEN is the number of bytes to actually read or write.
@@ -147,16 +116,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -166,9 +127,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -181,58 +139,45 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
-	/*
-	 * Now perform the requested operation into/out of the buffer.
-	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buffer_read(sfs->sfs_device, diskblock, &buf);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 * Whatever part of a write got in, even if the rest faulted,
+	 * is now the block's contents.
 	 */
+	result = uiomove((char *)buffer_map(buf) + skipstart, len, uio);
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		buffer_mark_dirty(buf);
 	}
+	buffer_release(buf);
 
-	return 0;
+	return result;
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Do I/O (either read or write) of a single whole block. A write
+ * overwrites all of it, so there's no need to read it first.
  */
 static
 int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -254,34 +199,94 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
-	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
-
-	/*
-	 * Temporarily set the residue to be one block size.
-	 */
 	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
 
-	result = sfs_rwblock(sfs, uio);
+	if (uio->uio_rw == UIO_READ) {
+		result = buffer_read(sfs->sfs_device, diskblock, &buf);
+	}
+	else {
+		result = buffer_get(sfs->sfs_device, diskblock, &buf);
+	}
+	if (result) {
+		return result;
+	}
+
+	result = uiomove(buffer_map(buf), SFS_BLOCKSIZE, uio);
 
 	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
+	 * A write that faulted partway leaves a block that wasn't cached
+	 * half garbage; let it be forgotten on release. A block that was
+	 * cached keeps what got in.
 	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	if (uio->uio_rw == UIO_WRITE && (result == 0 || buffer_valid(buf))) {
+		buffer_mark_dirty(buf);
+	}
+	buffer_release(buf);
 
 	return result;
 }
 
+/*
+ * Sequential read-ahead, after a read of START to END.
+ *
+ * A read that picks up where the last one on the file left off opens
+ * the read-ahead window, or doubles it up to SFS_RA_MAX; any other read
+ * closes it. While it's open, the blocks of the file within the window
+ * past END that haven't been asked for yet are handed to the disk
+ * through buffer_readahead, so it fetches them while the caller works
+ * on what it got.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, off_t start, off_t end)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t block, limit, fileblocks;
+	daddr_t diskblock;
+
+	if (start == sv->sv_ralast) {
+		if (sv->sv_rawindow == 0) {
+			sv->sv_rawindow = SFS_RA_MIN;
+		}
+		else if (sv->sv_rawindow < SFS_RA_MAX) {
+			sv->sv_rawindow *= 2;
+		}
+	}
+	else {
+		sv->sv_rawindow = 0;
+		sv->sv_raend = 0;
+	}
+	sv->sv_ralast = end;
+
+	if (sv->sv_rawindow == 0) {
+		return;
+	}
+
+	/* From the first block the read didn't touch, up to EOF */
+	block = (end + SFS_BLOCKSIZE - 1) / SFS_BLOCKSIZE;
+	limit = block + sv->sv_rawindow;
+	fileblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	if (limit > fileblocks) {
+		limit = fileblocks;
+	}
+	if (block < sv->sv_raend) {
+		block = sv->sv_raend;
+	}
+
+	for (; block < limit; block++) {
+		if (sfs_bmap(sv, block, false, &diskblock)) {
+			break;
+		}
+		/* Holes read as zeros; nothing to fetch */
+		if (diskblock != 0) {
+			buffer_readahead(sfs->sfs_device, diskblock);
+		}
+	}
+	if (block > sv->sv_raend) {
+		sv->sv_raend = block;
+	}
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
  */
@@ -292,8 +297,10 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	uint32_t nblocks, i;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	off_t origoffset;
 
 	origresid = uio->uio_resid;
+	origoffset = uio->uio_offset;
 
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
@@ -378,6 +385,11 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = true;
 	}
 
+	/* If reading, keep the blocks coming */
+	if (result == 0 && uio->uio_rw == UIO_READ) {
+		sfs_readahead(sv, origoffset, uio->uio_offset);
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -409,20 +421,10 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	uint32_t blockoffset;
 	daddr_t diskblock;
 	bool doalloc;
+	struct buf *buf;
+	char *ioptr;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
@@ -443,26 +445,21 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = buffer_read(sfs->sfs_device, diskblock, &buf);
 	if (result) {
 		return result;
 	}
+	ioptr = (char *)buffer_map(buf) + blockoffset;
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, ioptr, len);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		memcpy(ioptr, data, len);
+		buffer_mark_dirty(buf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -471,6 +468,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 			sv->sv_dirty = true;
 		}
 	}
+	buffer_release(buf);
 
 	/* Done */
 	return 0;
@@ -316,7 +316,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	}
 
 	/* Didn't exist - create it */
-	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
+	result = sfs_makeobj(sfs, SFS_TYPE_FILE, sv->sv_ino, &newguy);
 	if (result) {
 		vfs_biglock_release();
 		return result;
@@ -598,6 +598,7 @@ const struct vnode_ops sfs_fileops = {
 	.vop_mmap = sfs_mmap,
 	.vop_truncate = sfs_truncate,
 	.vop_namefile = vopfail_uio_notdir,
+	.vop_poll = vopnull_poll,
 
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
@@ -632,6 +633,7 @@ const struct vnode_ops sfs_dirops = {
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
 	.vop_namefile = sfs_namefile,
+	.vop_poll = vopnull_poll,
 
 	.vop_creat = sfs_creat,
 	.vop_symlink = vopfail_symlink_nosys,
@@ -37,13 +37,29 @@
 extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
 
+/* Read-ahead window: opens at SFS_RA_MIN blocks, doubles up to SFS_RA_MAX */
+#define SFS_RA_MIN 2
+#define SFS_RA_MAX 32
+
+/* Allocation groups and preallocation; see sfs_balloc.c */
+#define SFS_GROUPBLOCKS 1024	/* blocks per allocation group */
+#define SFS_GROUP_MINFREE 64	/* fewer free than this: group is full */
+#define SFS_PREALLOC 8		/* blocks in a preallocation window */
+
+/* Initial buckets in a directory's name hash; see sfs_dir.c */
+#define SFS_DIRHASH_MIN 16
+
 /* Macro for initializing a uio structure */
 #define SFSUIO(iov, uio, ptr, block, rw) \
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
 
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_groupinit(struct sfs_fs *sfs);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock);
+int sfs_balloc_file(struct sfs_vnode *sv, daddr_t goal, daddr_t *diskblock);
+void sfs_prealloc_discard(struct sfs_vnode *sv);
+daddr_t sfs_inodegoal(struct sfs_fs *sfs, uint32_t dirino);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
@@ -58,6 +74,7 @@ int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
 		int *slot);
 int sfs_dir_unlink(struct sfs_vnode *sv, int slot);
+void sfs_dirhash_destroy(struct sfs_vnode *sv);
 int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
@@ -67,7 +84,8 @@ int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
-int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
+int sfs_makeobj(struct sfs_fs *sfs, int type, uint32_t dirino,
+		struct sfs_vnode **ret);
 struct vnode *sfs_getroot(struct fs *fs);
 
 /* Functions in sfs_io.c */
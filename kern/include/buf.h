@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Block buffer cache.
+ *
+ * Holds recently used blocks of block devices in memory, keyed by
+ * (device, block number). A filesystem gets a block with buffer_read
+ * (contents loaded from disk if not already cached) or buffer_get
+ * (contents left alone, for a caller about to overwrite all of it),
+ * works on it through buffer_map, and hands it back with
+ * buffer_release. A buffer changed in memory is marked with
+ * buffer_mark_dirty; it goes back to disk later, when it is evicted,
+ * when too many buffers are dirty, when the syncer thread next runs,
+ * or when its device is synced. A buffer from buffer_get that wasn't cached holds
+ * garbage (buffer_valid is false) until it is filled in and marked
+ * dirty; released unfilled, it is simply forgotten.
+ *
+ * buffer_readahead starts reading a block into the cache and returns
+ * without waiting, so the caller gets on with something else while
+ * the disk works.
+ *
+ * Replacement is 2Q: a block seen once waits on a short probationary
+ * queue, and only a block used again moves to the main LRU queue, so
+ * streaming through a big file doesn't flush out directories and
+ * inodes. A block read ahead counts as unused until first got.
+ *
+ * The cache is covered by the vfs big lock, as is everything the
+ * filesystems do; all of these must be called with it held.
+ */
+
+struct device;
+struct buf;
+
+/* Size of a cached block. */
+#define BUFFER_SIZE	512
+
+/* Number of buffers the cache grows to before it starts evicting. */
+#define BUFFER_MAX	256
+
+void buffer_bootstrap(void);
+
+/* Get a referenced buffer for BLOCK of DEV. */
+int buffer_read(struct device *dev, daddr_t block, struct buf **ret);
+int buffer_get(struct device *dev, daddr_t block, struct buf **ret);
+
+/* Work on a buffer got with one of the above. */
+void *buffer_map(struct buf *b);
+bool buffer_valid(struct buf *b);
+void buffer_mark_dirty(struct buf *b);
+void buffer_release(struct buf *b);
+
+/* Start reading BLOCK of DEV into the cache; don't wait for it. */
+void buffer_readahead(struct device *dev, daddr_t block);
+
+/* Forget a block (e.g. it was freed), discarding any changes. */
+void buffer_drop(struct device *dev, daddr_t block);
+
+/* Write back the dirty buffers of DEV; then (for unmount) forget them. */
+int buffer_sync(struct device *dev);
+int buffer_drop_device(struct device *dev);
+
+
+#endif /* _BUF_H_ */
@@ -59,6 +59,9 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Exited threads kept for reuse */
+	struct thread *c_idlethread;	/* Parked idle thread, if any */
+	struct thread *c_migrating;	/* Thread leaving for another cpu */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
@@ -115,6 +118,13 @@ void cpu_hatch(unsigned software_number);
  */
 void cpu_identify(char *buf, size_t max);
 
+/*
+ * Read the free-running cycle counter of the current CPU. It wraps,
+ * so only the (unsigned) difference of two readings taken on the same
+ * CPU is meaningful.
+ */
+uint32_t cpu_getcycles(void);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -35,7 +35,9 @@
  */
 
 
-struct uio;  /* in <uio.h> */
+#include <uio.h>
+
+struct pollent;  /* in <poll.h> */
 
 /*
  * Filesystem-namespace-accessible device.
@@ -51,16 +53,44 @@ struct device {
 	void *d_data;		/* device-specific data */
 };
 
+/*
+ * Block I/O request, for devop_strategy.
+ *
+ * The data is in kernel memory, in bio_iovcnt pieces of whole blocks
+ * each, going to or from consecutive blocks starting at bio_block.
+ * When the transfer is over, the driver sets bio_error and calls
+ * bio_done, possibly from its interrupt handler; bio_done must not
+ * sleep. bio_next and bio_stamp belong to the driver while the
+ * request is queued.
+ */
+struct bio {
+	struct iovec *bio_iov;
+	unsigned bio_iovcnt;
+	daddr_t bio_block;		/* first block */
+	enum uio_rw bio_rw;
+	int bio_error;
+	void (*bio_done)(struct bio *);
+	void *bio_data;			/* for bio_done */
+	struct bio *bio_next;
+	unsigned bio_stamp;
+};
+
 /*
  * Device operations.
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_poll - as VOP_POLL; optional, devices without it never block
+ *      devop_strategy - queue a struct bio and return without waiting;
+ *                       optional, block devices only. Fails at once
+ *                       (and won't call bio_done) if the request is bad.
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	int (*devop_poll)(struct device *, int events, struct pollent *pe);
+	int (*devop_strategy)(struct device *, struct bio *);
 };
 
 /*
@@ -69,6 +99,8 @@ struct device_ops {
 #define DEVOP_EACHOPEN(d, f)	((d)->d_ops->devop_eachopen(d, f))
 #define DEVOP_IO(d, u)		((d)->d_ops->devop_io(d, u))
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
+#define DEVOP_POLL(d, ev, pe)	((d)->d_ops->devop_poll(d, ev, pe))
+#define DEVOP_STRATEGY(d, bio)	((d)->d_ops->devop_strategy(d, bio))
 
 
 /* Create vnode for a vfs-level device. */
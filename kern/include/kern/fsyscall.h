@@ -14,6 +14,16 @@ int sys_read(int, void *, size_t, int *);
 
 size_t sys_write(int, const void*, size_t, int32_t* retval);
 
+int sys_pread(int fd, void *buf, size_t buflen, off_t pos, int32_t *retval);
+
+int sys_pwrite(int fd, const void *buf, size_t nbytes, off_t pos, int32_t *retval);
+
+struct iovec;
+
+int sys_readv(int fd, const struct iovec *iov, int iovcnt, int32_t *retval);
+
+int sys_writev(int fd, const struct iovec *iov, int iovcnt, int32_t *retval);
+
 int sys_lseek(int fd, off_t pos, int whence, int32_t* retval, int32_t* retval2);
 
 int sys_chdir(const char *pathname);
@@ -21,3 +31,11 @@ int sys_chdir(const char *pathname);
 int sys__getcwd(char *buf, size_t buflen, int32_t *retval);
 
 int sys_dup2(int oldfd, int newfd, int32_t* retval);
+
+int sys_pipe(userptr_t fds, int32_t *retval);
+
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int32_t *retval);
+
+int sys_select(int nfds, userptr_t sets[3], userptr_t timeout, int32_t *retval);
+
+int sys_ioring_enter(userptr_t ring, unsigned to_submit, int32_t *retval);
@@ -34,6 +34,8 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/* Disk request scheduling (block devices); the argument is unused */
+#define IOCTL_SCHED_FIFO	1	/* in order of arrival */
+#define IOCTL_SCHED_CLOOK	2	/* one-way elevator, with deadline */
 
 #endif /* _KERN_IOCTL_H_*/
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2004, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_IORING_H_
+#define _KERN_IORING_H_
+
+/*
+ * Definitions for the batched I/O ring, for <sys/ioring.h> and the
+ * kernel.
+ *
+ * The process keeps a submission queue (SQ) and a completion queue
+ * (CQ) of the same power-of-two size in its own memory. It describes
+ * the ring with a struct io_ring. To run a batch, it fills SQ entries,
+ * advances ir_sqtail, and calls ioring_enter(). That one trap runs the
+ * entries in order. For each entry, it posts one CQ entry and advances
+ * ir_sqhead and ir_cqtail.
+ *
+ * The head and tail counters run freely; the slot for counter C is
+ * C & (ir_entries - 1). Each side writes only its own counters: the
+ * process writes ir_sqtail and ir_cqhead, the kernel writes ir_sqhead
+ * and ir_cqtail.
+ */
+
+#define IORING_MAX	4096	/* largest ring */
+
+/* Operations */
+#define IORING_OP_NOP		0	/* nothing; completes with 0 */
+#define IORING_OP_READ		1	/* read(fd, buf, len) */
+#define IORING_OP_WRITE		2	/* write(fd, buf, len) */
+#define IORING_OP_PREAD		3	/* pread(fd, buf, len, off) */
+#define IORING_OP_PWRITE	4	/* pwrite(fd, buf, len, off) */
+#define IORING_OP_LSEEK		5	/* lseek(fd, off, whence) */
+#define IORING_OP_CLOSE		6	/* close(fd) */
+
+/* Submission queue entry */
+struct io_sqe {
+	__u32 sqe_op;		/* IORING_OP_* */
+	__i32 sqe_fd;		/* file descriptor */
+	__i64 sqe_off;		/* offset for pread, pwrite, lseek */
+#ifdef _KERNEL
+	userptr_t sqe_buf;	/* buffer for read and write ops */
+#else
+	void *sqe_buf;
+#endif
+	__u32 sqe_len;		/* length of sqe_buf */
+	__i32 sqe_whence;	/* whence for lseek */
+	__u32 sqe_data;		/* caller's cookie, copied to the CQ entry */
+};
+
+/* Completion queue entry */
+struct io_cqe {
+	__i64 cqe_res;		/* what the call would have returned */
+	__u32 cqe_data;		/* sqe_data of the entry that completed */
+	__i32 cqe_err;		/* errno of the call, or 0 on success */
+};
+
+/* The ring */
+struct io_ring {
+	__u32 ir_entries;	/* size of both queues; a power of two */
+	__u32 ir_sqtail;	/* next SQ slot to fill (process) */
+	__u32 ir_cqhead;	/* next CQ entry to reap (process) */
+	__u32 ir_sqhead;	/* next SQ entry to run (kernel) */
+	__u32 ir_cqtail;	/* next CQ slot to post (kernel) */
+#ifdef _KERNEL
+	userptr_t ir_sq;	/* submission queue */
+	userptr_t ir_cq;	/* completion queue */
+#else
+	struct io_sqe *ir_sq;
+	struct io_cqe *ir_cq;
+#endif
+};
+
+
+#endif /* _KERN_IORING_H_ */
@@ -80,7 +80,7 @@
 #define __PID_MAX       32767
 
 /* Max open files per process */
-#define __OPEN_MAX      32
+#define __OPEN_MAX      128
 
 /* Max bytes for atomic pipe I/O -- see description in the pipe() man page */
 #define __PIPE_BUF      512
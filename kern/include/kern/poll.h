@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2004, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+#include <kern/limits.h>
+
+/*
+ * Definitions for poll() and select(), for <poll.h>, <sys/select.h>
+ * and the kernel.
+ */
+
+struct pollfd {
+	int fd;			/* file descriptor, or negative to skip */
+	short events;		/* events wanted */
+	short revents;		/* events that happened */
+};
+
+/* Events. POLLERR, POLLHUP and POLLNVAL are reported whether asked for or not. */
+#define POLLIN		0x0001	/* readable without blocking */
+#define POLLPRI		0x0002	/* urgent data (never happens) */
+#define POLLOUT		0x0004	/* writable without blocking */
+#define POLLERR		0x0008	/* error (e.g. the reader of a pipe is gone) */
+#define POLLHUP		0x0010	/* hung up (the writer of a pipe is gone) */
+#define POLLNVAL	0x0020	/* fd isn't open */
+
+/*
+ * fd_set for select(). A bitmap of file descriptors, one bit per fd,
+ * in 32-bit words.
+ */
+#define __FD_SETSIZE	__OPEN_MAX
+
+typedef struct {
+	__u32 fds_bits[(__FD_SETSIZE + 31) / 32];
+} fd_set;
+
+
+#endif /* _KERN_POLL_H_ */
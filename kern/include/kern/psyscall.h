@@ -7,18 +7,23 @@
 #include <mips/trapframe.h>
 
 
-#define ADDR_MIPS 32
-
 pid_t sys_getpid(void);
 
 int sys_fork(struct trapframe*, int *retval);
 
+int sys_vfork(struct trapframe*, int *retval);
+
 int sys_waitpid(pid_t pid, int *status, int options);
 
 void sys__exit(int exitcode);
 
-void sys_execv(const char *, char **, int *);
+void sys_execv(const char *, char **, char **env, int *);
+
+int sys_spawn(const char *, char **, const int *fds, int nfds, int *retval);
 
 void * sys_sbrk(intptr_t amount, int *retval);
 
-int get_size(char*);
+int sys_setaffinity(pid_t pid, unsigned mask);
+
+int sys_getaffinity(pid_t pid, unsigned *mask);
+
@@ -41,9 +41,10 @@
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
-#define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
-#define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
+#define SFS_NDINDIRECT    1             /* # of 2x indirect blocks in inode */
+#define SFS_NTINDIRECT    1             /* # of 3x indirect blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
+#define SFS_NEXTENTS      35            /* # of extents in inode */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
 #define SFS_FREEMAP_START 2             /* 1st block of the freemap */
@@ -62,6 +63,10 @@
 /* Size of free block bitmap (in blocks) */
 #define SFS_FREEMAPBLOCKS(nblocks)  (SFS_FREEMAPBITS(nblocks)/SFS_BITSPERBLOCK)
 
+/* Superblock feature flags for sb_features */
+#define SFS_FEATURE_EXTENTS 0x1   /* inodes use sfi_extents */
+#define SFS_FEATURES        SFS_FEATURE_EXTENTS  /* all of them */
+
 /* File types for sfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
 #define SFS_TYPE_FILE     1
@@ -74,7 +79,25 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_features;			/* SFS_FEATURE_* */
+	uint32_t reserved[117];			/* unused, set to 0 */
+};
+
+/*
+ * On-disk extent: a run of consecutive blocks of a file stored in
+ * consecutive blocks of the disk.
+ *
+ * On a volume with SFS_FEATURE_EXTENTS, each inode has an array of
+ * these, in order of sfe_fileblock, with the unused ones (sfe_len 0)
+ * at the end. A block of the file is looked for in the extents first
+ * and then in the direct and indirect blocks, which take whatever no
+ * longer fits once the array is full; no block is in both. Elsewhere
+ * the array is unused and must be zero.
+ */
+struct sfs_extent {
+	uint32_t sfe_fileblock;			/* First block of the file */
+	uint32_t sfe_diskblock;			/* Where it is on disk */
+	uint32_t sfe_len;			/* Number of blocks */
 };
 
 /*
@@ -86,7 +109,11 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	struct sfs_extent sfi_extents[SFS_NEXTENTS];	/* Extents */
+	uint32_t sfi_waste[128-5-SFS_NDIRECT-3*SFS_NEXTENTS];
+						/* unused space, set to 0 */
 };
 
 /*
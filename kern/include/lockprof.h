@@ -0,0 +1,40 @@
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+/*
+ * Lock contention profiling. Only built with "options lockprof".
+ *
+ * Sleep locks, spinlocks and CVs each point at a profiling record,
+ * shared by every lock of the same kind with the same name (so all
+ * the per-file "fd lock"s show up as one line). The hooks below are
+ * called from synch.c and spinlock.c; times are in cpu cycles from
+ * cpu_getcycles().
+ *
+ * For CVs, "acquires" counts waits and the wait/hold columns are the
+ * time spent asleep.
+ */
+
+#define LOCKPROF_SLEEPLOCK	0
+#define LOCKPROF_SPINLOCK	1
+#define LOCKPROF_CV		2
+
+struct lockprof;	/* Opaque. */
+
+/*
+ * lockprof_get	   Return the record for NAME of kind KIND, making one
+ *		   if needed. Never fails; if the table is full the
+ *		   overflow record is returned. Does not keep NAME.
+ * lockprof_acquired  Count one acquisition; WAITED is the number of
+ *		   cycles spent getting it, and is only added to the
+ *		   wait total if CONTENDED.
+ * lockprof_released  Note a hold (or CV sleep) of HELD cycles.
+ * lockprof_report    Print the table, most wait time first, and reset
+ *		   all the counters.
+ */
+struct lockprof *lockprof_get(const char *name, int kind);
+void lockprof_acquired(struct lockprof *lp, bool contended, uint32_t waited);
+void lockprof_released(struct lockprof *lp, uint32_t held);
+void lockprof_report(void);
+
+
+#endif /* _LOCKPROF_H_ */
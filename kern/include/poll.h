@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Readiness notification for poll and select.
+ *
+ * Anything that can become readable or writable (a pipe, the console)
+ * keeps a struct pollq and calls pollq_wakeup whenever its state
+ * changes. VOP_POLL reports which events are ready now and, if handed
+ * a pollent, first registers it on the object's pollq, so a change
+ * after the check still wakes the poller.
+ *
+ * pollq_wakeup may be called from interrupt handlers.
+ */
+
+#include <spinlock.h>
+#include <kern/time.h>
+
+struct wchan;
+struct pollwaiter;
+
+/* One registration of a waiter on one pollq. */
+struct pollent {
+	struct pollwaiter *pe_waiter;
+	struct pollq *pe_q;		/* NULL if not registered */
+	struct pollent *pe_next;	/* on pe_q */
+};
+
+struct pollq {
+	struct spinlock pq_lock;
+	struct pollent *pq_head;
+};
+
+/* A thread sleeping in poll or select. */
+struct pollwaiter {
+	struct spinlock pw_lock;
+	struct wchan *pw_wchan;
+	bool pw_woken;			/* something changed since pollwaiter_reset */
+	bool pw_timed;			/* on the timeout list */
+	bool pw_timedout;
+	struct timespec pw_deadline;
+	struct pollwaiter *pw_timenext;
+};
+
+void pollq_init(struct pollq *pq);
+void pollq_cleanup(struct pollq *pq);
+void pollq_register(struct pollq *pq, struct pollent *pe);
+void pollq_wakeup(struct pollq *pq);
+
+void pollent_init(struct pollent *pe, struct pollwaiter *pw);
+void pollent_unregister(struct pollent *pe);
+
+/*
+ * pollwaiter_init: TIMEOUT_MS < 0 waits forever.
+ * pollwaiter_reset: forget wakeups so far; call before rescanning.
+ * pollwaiter_sleep: sleep until woken; returns false on timeout.
+ */
+int pollwaiter_init(struct pollwaiter *pw, int timeout_ms);
+void pollwaiter_cleanup(struct pollwaiter *pw);
+void pollwaiter_reset(struct pollwaiter *pw);
+bool pollwaiter_sleep(struct pollwaiter *pw);
+
+/* Called from hardclock to expire timed waiters. */
+void poll_hardclock(void);
+
+
+#endif /* _POLL_H_ */
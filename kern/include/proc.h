@@ -41,6 +41,10 @@
 #include <limits.h>
 struct addrspace;
 struct vnode;
+struct lock;
+struct bitmap;
+struct cv;
+struct semaphore;
 
 #define READY 0
 #define RUNNING 1
@@ -57,8 +61,24 @@ struct file_info {
 	int status_flag;
 	off_t offset;
 	int ref_count;
+	struct file_info *fd_next;	/* on the free list */
 };
 
+/*
+ * Open file table. It starts at FDTABLE_MIN slots and doubles up to
+ * OPEN_MAX. Lookups index it without taking any lock, so an outgrown
+ * table isn't freed; it stays on ft_prev until the process goes away.
+ * Slots 0-2 are always marked in ft_map so open never hands them out.
+ */
+struct fdtable {
+	int ft_nfiles;			/* slots in ft_ofiles */
+	struct file_info **ft_ofiles;
+	struct bitmap *ft_map;		/* slots in use; NULL once outgrown */
+	struct fdtable *ft_prev;	/* outgrown table, or NULL */
+};
+
+#define FDTABLE_MIN 16
+
 /*
  * Process structure.
  */
@@ -74,40 +94,91 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
-	struct lock *fd_lock;
-	struct file_info *fd[__OPEN_MAX];
+	struct lock *fd_lock;		/* slot changes; lookups take no lock */
+	struct fdtable *p_fdt;		/* open files */
 
 
 	pid_t pid;
+
+	/* Family; changed only by the parent's own thread (fork, exit) */
+	struct proc *p_parent;		/* NULL once orphaned */
+	struct proc *p_children;	/* first child */
+	struct proc *p_nextsib;		/* parent's next child */
+	struct proc *p_prevsib;		/* parent's previous child */
+
 	struct trapframe *fork_frame;
+	struct semaphore *p_vfork;	/* vfork parent waits here while we
+					   borrow its address space */
 	/* add more material here as needed */
 };
 
 struct pid_entry{
 	pid_t pid;
 	struct proc *proc;
-	struct lock *pid_lock;
+	struct lock *pid_lock;		/* status/waitcode of this pid */
+	struct cv *pid_cv;		/* waitpid sleeps here for this pid */
 };
 
 struct pid_entry *p_table[PID_MAX];
 int pid_status[__PID_MAX];
 int pid_parent[__PID_MAX];
 int pid_waitcode[__PID_MAX];
-struct cv* pid_cv;
 
-struct lock *pid_lock;
+/*
+ * Process table locking. There is no table-wide lock.
+ *
+ * The table is striped: the stripe lock for a pid (a spinlock, in
+ * proc.c) covers p_table[pid] and pid_parent[pid], so lookups and
+ * slot changes for unrelated pids don't contend. The exit/waitpid
+ * handshake for a pid (pid_status RUNNING -> ZOMBIE/ORPHAN, and
+ * pid_waitcode) uses only that pid's own entry: its pid_lock and
+ * pid_cv.
+ *
+ * An entry is freed only by its parent's exit (once a zombie) or by
+ * its own exit (if orphaned), so a parent can use its children's
+ * entries without holding a stripe lock.
+ */
+#define PID_NSTRIPES 32
 
 struct pid_entry *pid_entry_create(void);
 
+/*
+ * Look up PID as a child of PARENT. Returns ESRCH if there is no such
+ * pid, ECHILD if it belongs to someone else.
+ */
+int pid_getchild(pid_t pid, struct proc *parent, struct pid_entry **ret);
+
 struct file_info *fd_create(void);
 
 void fd_destroy(struct file_info *fd);
+
+/*
+ * File table slots. fd_get may be called without any lock and returns
+ * NULL for an empty or out-of-range slot. The rest need P's fd_lock:
+ * fd_grow makes slot FD exist, fd_alloc reserves the lowest free slot
+ * from 3 up (growing as needed), and fd_install fills or empties a slot.
+ */
+struct file_info *fd_get(struct proc *p, int fd);
+int fd_grow(struct proc *p, int fd);
+int fd_alloc(struct proc *p, int *fd);
+void fd_install(struct proc *p, int fd, struct file_info *fh);
+/* Free a pid and its entry; nobody else may be using the entry. */
 void pid_destroy(struct pid_entry *ptr);
 
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
 struct proc* proc_fork(const char *name);
+
+/*
+ * Child lists. proc_addchild makes CHILD a child of PARENT, and
+ * proc_remchild unlinks CHILD from its parent; both must be called by
+ * the parent. proc_unfork undoes a fork that failed partway: it
+ * unlinks CHILD, frees its pid, and destroys it.
+ */
+void proc_addchild(struct proc *parent, struct proc *child);
+void proc_remchild(struct proc *child);
+void proc_unfork(struct proc *child);
 /* Call once during system startup to allocate data structures. */
 void proc_bootstrap(void);
 
@@ -56,6 +56,12 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	off_t sv_ralast;                /* where the last read ended */
+	uint32_t sv_raend;              /* blocks before this read ahead */
+	unsigned sv_rawindow;           /* read-ahead blocks; 0 if random */
+	daddr_t sv_pastart;             /* preallocated blocks: first */
+	unsigned sv_palen;              /*   and how many */
+	struct sfs_dirhash *sv_dirhash; /* name table (directories only) */
 };
 
 /*
@@ -69,6 +75,8 @@ struct sfs_fs {
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	unsigned *sfs_groupfree;        /* free blocks per alloc group */
+	unsigned sfs_ngroups;           /* number of alloc groups */
 };
 
 /*
@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockprof.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -55,14 +56,33 @@
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
-	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	volatile spinlock_data_t splk_next;  /* Next ticket to hand out. */
+	volatile spinlock_data_t splk_owner; /* Ticket now holding the lock. */
+	struct cpu *splk_holder;	     /* CPU holding this lock. */
+#if OPT_LOCKPROF
+	const char *splk_name;		    /* Name for profiling, or NULL */
+	struct lockprof *splk_prof;	    /* Profiling record (set lazily) */
+	uint32_t splk_acqtime;		    /* Cycle count when acquired */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
+ * The _NAMED version gives the lock a name for the lock profiler; the
+ * name must be a string constant.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKPROF
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, \
+	  NULL, NULL, 0 }
+#define SPINLOCK_INITIALIZER_NAMED(name) \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, \
+	  name, NULL, 0 }
+#else
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER_NAMED(name) SPINLOCK_INITIALIZER
+#endif
 
 /*
  * Spinlock functions.
@@ -71,9 +91,14 @@ struct spinlock {
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
+ *		Waiting CPUs get the lock in first-come first-served order.
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ *
+ * setname	Name the lock for the lock profiler. The name must stay
+ *		valid as long as the lock does. Does nothing unless the
+ *		kernel is built with "options lockprof".
  */
 
 void spinlock_init(struct spinlock *lk);
@@ -84,5 +109,7 @@ void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+void spinlock_setname(struct spinlock *lk, const char *name);
+
 
 #endif /* _SPINLOCK_H_ */
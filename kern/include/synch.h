@@ -78,6 +78,11 @@ struct lock {
 		struct thread *holder;
 		struct wchan *lock_wchan;
 		struct spinlock lock_splk;
+		volatile unsigned lock_sleepers;	/* threads on lock_wchan */
+#if OPT_LOCKPROF
+		struct lockprof *lk_prof;	/* contention profiling record */
+		uint32_t lk_acqtime;		/* cycle count when acquired */
+#endif
         // add what you need here
         // (don't forget to mark things volatile as needed)
 };
@@ -88,7 +93,8 @@ void lock_destroy(struct lock *);
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
- *                   same time.
+ *                   same time. If the holder is running on another cpu,
+ *                   spins briefly before going to sleep (adaptive lock).
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
 *    lock_do_i_hold - Return true if the current thread holds the lock;
@@ -113,13 +119,23 @@ bool lock_do_i_hold(struct lock *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * A CV can be put in wait-morphing mode with cv_setmorph. Then
+ * cv_signal and cv_broadcast don't make the waiters runnable; they
+ * move them straight onto the wait channel of the lock passed in,
+ * which the signaller holds. Each waiter is woken by a lock_release
+ * in turn, instead of all of them waking at once only to pile up
+ * on the lock again.
  */
 
 struct cv {
         char *cv_name;
 		struct wchan *cv_wchan;
 		struct spinlock cv_splk;
-		struct spinlock cv_splk_2;
+		bool cv_morph;			/* wait-morphing; see cv_setmorph */
+#if OPT_LOCKPROF
+		struct lockprof *cv_prof;	/* contention profiling record */
+#endif
 		// add what you need here
         // add what you need here
         // (don't forget to mark things volatile as needed)
@@ -127,6 +143,7 @@ struct cv {
 
 struct cv *cv_create(const char *name);
 void cv_destroy(struct cv *);
+void cv_setmorph(struct cv *, bool morph);
 
 /*
  * Operations:
@@ -146,4 +163,54 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once; a writer holds it
+ * exclusively. Writers are preferred: once a writer is waiting, new
+ * readers queue behind it. To keep readers from starving, when a
+ * writer releases the lock every reader that was already waiting is
+ * let in as a batch before the next writer gets a turn. Ownership is
+ * handed directly to the threads being woken, so nobody can sneak in
+ * between the wakeup and the woken thread running.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+	char *rwlock_name;
+	struct spinlock rw_splk;	/* protects everything below */
+	struct wchan *rw_rwchan;	/* waiting readers */
+	struct wchan *rw_wwchan;	/* waiting writers */
+	volatile unsigned rw_readers;	/* readers holding the lock */
+	volatile unsigned rw_rwaiting;	/* readers asleep on rw_rwchan */
+	volatile unsigned rw_wwaiting;	/* writers asleep on rw_wwchan */
+	volatile unsigned rw_rgen;	/* bumped when a reader batch is let in */
+	volatile unsigned rw_wgrant;	/* writer turns handed out, not taken */
+	volatile bool rw_writing;	/* a writer holds (or was granted) it */
+	struct thread *rw_writer;	/* which writer, once it's running */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Blocks while a
+ *                           writer holds the lock or is waiting for it.
+ *    rwlock_release_read  - Drop a read hold.
+ *    rwlock_acquire_write - Get the lock exclusively.
+ *    rwlock_release_write - Drop the exclusive hold. Only the thread
+ *                           holding the lock for writing may do this.
+ *    rwlock_do_i_write    - Return true if the current thread holds
+ *                           the lock for writing. (Read holds are not
+ *                           tracked per thread.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
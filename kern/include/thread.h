@@ -83,6 +83,7 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	uint32_t t_affinity;		/* CPUs thread may run on */
 
 	/*
 	 * Interrupt state fields.
@@ -108,6 +109,13 @@ struct thread {
 	/* add more here as needed */
 };
 
+/*
+ * CPU affinity masks: bit N set means the thread may run on cpu N.
+ * (System/161 has at most 32 cpus.)
+ */
+#define THREAD_AFFINITY_ALL	0xffffffff
+#define THREAD_AFFINITY_CPU(n)	((uint32_t)1 << (n))
+
 /*
  * Array of threads.
  */
@@ -157,6 +165,20 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * CPU affinity. thread_setaffinity restricts thread T to the cpus in
+ * MASK; it fails with EINVAL if none of them exist. If T is the
+ * current thread and the current cpu isn't in MASK, it moves before
+ * returning; other threads move the next time they are scheduled.
+ * New threads inherit the affinity of the thread that forked them.
+ *
+ * thread_getaffinity returns T's mask, limited to the cpus that
+ * exist, and thread_cpumask returns the mask of all cpus.
+ */
+int thread_setaffinity(struct thread *t, uint32_t mask);
+uint32_t thread_getaffinity(struct thread *t);
+uint32_t thread_cpumask(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -33,6 +33,7 @@
 #include <spinlock.h>
 struct uio;
 struct stat;
+struct pollent;
 
 
 /*
@@ -132,6 +133,12 @@ struct vnode {
  *                      uio. Need not work on objects that are not
  *                      directories.
  *
+ *    vop_poll        - Return which of the POLL* EVENTS (kern/poll.h)
+ *                      are ready now. If PE is not NULL, first register
+ *                      it with pollq_register on whatever will be woken
+ *                      when that changes (see poll.h). Objects that
+ *                      never block can use vopnull_poll.
+ *
  *****************************************
  *
  *    vop_creat       - Create a regular file named NAME in the passed
@@ -196,6 +203,7 @@ struct vnode_ops {
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
+	int (*vop_poll)(struct vnode *object, int events, struct pollent *pe);
 
 
 	int (*vop_creat)(struct vnode *dir,
@@ -240,6 +248,7 @@ struct vnode_ops {
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
+#define VOP_POLL(vn, events, pe)        (__VOP(vn, poll)(vn, events, pe))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
 #define VOP_SYMLINK(vn, name, content)  (__VOP(vn, symlink)(vn, name, content))
@@ -315,5 +324,10 @@ int vopfail_lookup_notdir(struct vnode *vn, char *path, struct vnode **result);
 int vopfail_lookparent_notdir(struct vnode *vn, char *path,
 			      struct vnode **result, char *buf, size_t len);
 
+/*
+ * VOP_POLL for objects that never block: always readable and writable.
+ */
+int vopnull_poll(struct vnode *vn, int events, struct pollent *pe);
+
 
 #endif /* _VNODE_H_ */
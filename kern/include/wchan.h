@@ -76,5 +76,13 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move one thread (or, if ALL is true, every thread) sleeping on FROM
+ * over to TO without waking it. Both spinlocks should be locked.
+ * Returns the number of threads moved.
+ */
+unsigned wchan_move(struct wchan *from, struct spinlock *fromlk,
+		    struct wchan *to, struct spinlock *tolk, bool all);
+
 
 #endif /* _WCHAN_H_ */
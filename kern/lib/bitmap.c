@@ -95,29 +95,89 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
-int
-bitmap_alloc(struct bitmap *b, unsigned *index)
+/*
+ * Index of the lowest cleared bit in W, which has one.
+ */
+static
+inline
+unsigned
+bitmap_lowzero(WORD_TYPE w)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        /* Just the lowest cleared bit, set; then its position */
+        WORD_TYPE x = (WORD_TYPE)(~w & (w + 1));
+
+        return ((x & 0xf0) ? 4 : 0) + ((x & 0xcc) ? 2 : 0) +
+                ((x & 0xaa) ? 1 : 0);
+}
+
+/*
+ * Find the lowest cleared bit from START up to (not including) END.
+ * Runs of full words are skipped four at a time where they're aligned
+ * for it; all-ones is all-ones in any byte order, so that's safe, and
+ * a nearly full map is mostly such runs.
+ */
+static
+bool
+bitmap_scan(struct bitmap *b, unsigned start, unsigned end, unsigned *index)
+{
+        unsigned ix = start / BITS_PER_WORD;
+        unsigned offset = start % BITS_PER_WORD;
+        unsigned bit;
+        WORD_TYPE w;
+
+        while (ix*BITS_PER_WORD < end) {
+                if (offset == 0 &&
+                    (uintptr_t)&b->v[ix] % sizeof(uint32_t) == 0 &&
+                    (ix + sizeof(uint32_t))*BITS_PER_WORD <= end &&
+                    *(uint32_t *)&b->v[ix] == 0xffffffff) {
+                        ix += sizeof(uint32_t);
+                        continue;
+                }
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
+                /* Treat the bits below START as set */
+                w = b->v[ix] | (WORD_TYPE)(((WORD_TYPE)1 << offset) - 1);
+                if (w != WORD_ALLBITS) {
+                        bit = ix*BITS_PER_WORD + bitmap_lowzero(w);
+                        if (bit >= end) {
+                                return false;
                         }
-                        KASSERT(0);
+                        *index = bit;
+                        return true;
                 }
+                ix++;
+                offset = 0;
+        }
+        return false;
+}
+
+int
+bitmap_alloc(struct bitmap *b, unsigned *index)
+{
+        if (!bitmap_scan(b, 0, b->nbits, index)) {
+                return ENOSPC;
+        }
+        bitmap_mark(b, *index);
+        return 0;
+}
+
+/*
+ * Like bitmap_alloc, but start at bit START and wrap around at the end.
+ * With START just past the last bit handed out, this cycles through
+ * the map instead of reusing the lowest free bit every time, and the
+ * search usually stops at the first word it looks at.
+ */
+int
+bitmap_alloc_from(struct bitmap *b, unsigned start, unsigned *index)
+{
+        if (start >= b->nbits) {
+                start = 0;
+        }
+        if (!bitmap_scan(b, start, b->nbits, index) &&
+            !bitmap_scan(b, 0, start, index)) {
+                return ENOSPC;
         }
-        return ENOSPC;
+        bitmap_mark(b, *index);
+        return 0;
 }
 
 static
@@ -29,6 +29,8 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/ioctl.h>
 #include <kern/reboot.h>
 #include <kern/unistd.h>
 #include <limits.h>
@@ -38,6 +40,7 @@
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
+#include <vnode.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <kern/psyscall.h>
@@ -45,6 +48,10 @@
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockprof.h"
+#if OPT_LOCKPROF
+#include <lockprof.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -376,6 +383,45 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command to choose how a disk orders its requests.
+ */
+static
+int
+cmd_iosched(int nargs, char **args)
+{
+	struct vnode *vn;
+	int op, result;
+
+	if (nargs != 3) {
+		kprintf("Usage: iosched device: fifo|clook\n");
+		return EINVAL;
+	}
+
+	if (!strcmp(args[2], "fifo")) {
+		op = IOCTL_SCHED_FIFO;
+	}
+	else if (!strcmp(args[2], "clook")) {
+		op = IOCTL_SCHED_CLOOK;
+	}
+	else {
+		kprintf("Unknown scheduler %s\n", args[2]);
+		return EINVAL;
+	}
+
+	/*
+	 * Give the raw name (lhd0raw:) to reach the device even when
+	 * a filesystem is mounted on it.
+	 */
+	result = vfs_open(args[1], O_RDONLY, 0, &vn);
+	if (result) {
+		return result;
+	}
+	result = VOP_IOCTL(vn, op, NULL);
+	vfs_close(vn);
+	return result;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -417,6 +463,22 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_LOCKPROF
+/*
+ * Command for printing (and resetting) lock contention statistics.
+ */
+static
+int
+cmd_lockprof(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockprof_report();
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -456,6 +518,7 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[iosched] Set disk scheduler        ",
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -488,8 +551,9 @@ static const char *testmenu[] = {
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
-	"[sy3] CV test               (1)     ",
+	"[sy3] CV test [morph]       (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] RW lock test                  ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
@@ -523,6 +587,9 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if OPT_LOCKPROF
+	"[lp] Lock profile (and reset)       ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -563,6 +630,7 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "iosched",	cmd_iosched },
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -577,6 +645,9 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if OPT_LOCKPROF
+	{ "lp",		cmd_lockprof },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -598,6 +669,7 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	rwtest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
@@ -49,17 +49,24 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <synch.h>
+#include <kern/errno.h>
 #include <kern/unistd.h>
 #include <kern/fcntl.h>
 #include <vfs.h>
 #include <limits.h>
+#include <bitmap.h>
+#include <membar.h>
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
-struct lock *pid_lock;
 //struct pid_entry*  pids[10];
-pid_t pid_counter;
+pid_t pid_counter;		/* where the next pid search starts */
+static struct bitmap *pid_map;	/* pids in use */
+static struct spinlock pid_map_lock;	/* for pid_map and pid_counter */
+static struct spinlock pid_stripe_lock[PID_NSTRIPES];
+
+#define PID_STRIPE(pid) (&pid_stripe_lock[(pid) % PID_NSTRIPES])
 struct pid_entry *p_table[__PID_MAX];
 int pid_status[__PID_MAX];
 int pid_parent[__PID_MAX];
@@ -80,23 +87,50 @@ struct pid_entry *pid_entry_create(void){
 		return NULL;
 	}
 
+	// An exit moves the waiting parent straight onto pid_lock's queue
+	pe->pid_cv = cv_create("pid");
+	if (pe->pid_cv == NULL){
+		lock_destroy(pe->pid_lock);
+		kfree(pe);
+		return NULL;
+	}
+	cv_setmorph(pe->pid_cv, true);
+
 	return pe;
 }
 
+/*
+ * Dead file_infos are kept here for reuse instead of being freed: a
+ * lockless lookup may still be about to lock one it read out of a file
+ * table, so the memory, and the lock in it, has to stay valid.
+ */
+static struct spinlock fd_free_lock = SPINLOCK_INITIALIZER;
+static struct file_info *fd_freelist;
+
 struct file_info *fd_create(void){
 
-	struct file_info *fd = (struct file_info*)kmalloc(sizeof(struct file_info));
+	struct file_info *fd;
 
-	if (fd == NULL){
-		return NULL;
+	spinlock_acquire(&fd_free_lock);
+	fd = fd_freelist;
+	if (fd != NULL) {
+		fd_freelist = fd->fd_next;
 	}
-	struct lock *lock = lock_create("fd lock");
+	spinlock_release(&fd_free_lock);
 
-	if (lock == NULL){
-		return NULL;
+	if (fd == NULL){
+		fd = (struct file_info*)kmalloc(sizeof(struct file_info));
+		if (fd == NULL){
+			return NULL;
+		}
+		fd->fd_lock = lock_create("fd lock");
+		if (fd->fd_lock == NULL){
+			kfree(fd);
+			return NULL;
+		}
 	}
 
-	fd->fd_lock = lock;
+	fd->fd_next = NULL;
 	fd->file = NULL;
 	fd->offset = 0;
 	fd->status_flag = -1;
@@ -108,19 +142,232 @@ struct file_info *fd_create(void){
 void pid_destroy(struct pid_entry *ptr) {
 	if (ptr != NULL) {
 		int pid = ptr->pid;
-		lock_destroy(ptr->pid_lock);
-		//proc_destroy(ptr->proc);
+
+		// Empty the slot before the pid can be handed out again
+		spinlock_acquire(PID_STRIPE(pid));
+		KASSERT(p_table[pid] == ptr);
+		p_table[pid] = NULL;
 		pid_status[pid] = READY;
 		pid_parent[pid] = -1;
 		pid_waitcode[pid] = -1;
+		spinlock_release(PID_STRIPE(pid));
+
+		spinlock_acquire(&pid_map_lock);
+		bitmap_unmark(pid_map, pid);
+		spinlock_release(&pid_map_lock);
+
+		cv_destroy(ptr->pid_cv);
+		lock_destroy(ptr->pid_lock);
+		//proc_destroy(ptr->proc);
 		kfree(ptr);
 	}
 }
 
+// Allocate a pid and a table entry for PROC; returns -1 if out of either
+static pid_t pid_alloc(struct proc *proc) {
+	struct pid_entry *pe;
+	unsigned pid;
+	int result;
+
+	pe = pid_entry_create();
+	if (pe == NULL) {
+		return -1;
+	}
+
+	// Next free pid at or after the cursor, so pids aren't reused
+	// right away and the search doesn't rescan the low ones
+	spinlock_acquire(&pid_map_lock);
+	result = bitmap_alloc_from(pid_map, pid_counter, &pid);
+	if (result == 0) {
+		pid_counter = pid + 1;
+	}
+	spinlock_release(&pid_map_lock);
+	if (result) {
+		cv_destroy(pe->pid_cv);
+		lock_destroy(pe->pid_lock);
+		kfree(pe);
+		return -1;
+	}
+
+	pe->pid = pid;
+	pe->proc = proc;
+	spinlock_acquire(PID_STRIPE(pid));
+	KASSERT(p_table[pid] == NULL);
+	p_table[pid] = pe;
+	pid_status[pid] = RUNNING;
+	pid_parent[pid] = -1;
+	pid_waitcode[pid] = -1;
+	spinlock_release(PID_STRIPE(pid));
+
+	return pid;
+}
+
+int pid_getchild(pid_t pid, struct proc *parent, struct pid_entry **ret) {
+	struct pid_entry *pe;
+	int result = 0;
+
+	if (pid < __PID_MIN || pid >= __PID_MAX) {
+		return ESRCH;
+	}
+
+	spinlock_acquire(PID_STRIPE(pid));
+	pe = p_table[pid];
+	if (pe == NULL) {
+		result = ESRCH;
+	} else if (pid_parent[pid] != parent->pid) {
+		result = ECHILD;
+	}
+	spinlock_release(PID_STRIPE(pid));
+
+	*ret = pe;
+	return result;
+}
+
 void fd_destroy(struct file_info *fd){
 	KASSERT(fd != NULL);
-	lock_destroy(fd->fd_lock);
-	kfree(fd);
+	fd->file = NULL;
+
+	spinlock_acquire(&fd_free_lock);
+	fd->fd_next = fd_freelist;
+	fd_freelist = fd;
+	spinlock_release(&fd_free_lock);
+}
+
+static struct fdtable *fdtable_create(int nfiles){
+	struct fdtable *ft;
+
+	ft = kmalloc(sizeof(*ft));
+	if (ft == NULL) {
+		return NULL;
+	}
+	ft->ft_ofiles = kmalloc(nfiles * sizeof(struct file_info *));
+	ft->ft_map = bitmap_create(nfiles);
+	if (ft->ft_ofiles == NULL || ft->ft_map == NULL) {
+		if (ft->ft_map != NULL) {
+			bitmap_destroy(ft->ft_map);
+		}
+		kfree(ft->ft_ofiles);
+		kfree(ft);
+		return NULL;
+	}
+	for (int i = 0; i < nfiles; i++) {
+		ft->ft_ofiles[i] = NULL;
+	}
+	for (int i = 0; i < 3; i++) {
+		bitmap_mark(ft->ft_map, i);
+	}
+	ft->ft_nfiles = nfiles;
+	ft->ft_prev = NULL;
+	return ft;
+}
+
+/* Free a table and everything it outgrew; its files are already gone. */
+static void fdtable_destroy(struct fdtable *ft){
+	struct fdtable *prev;
+
+	while (ft != NULL) {
+		prev = ft->ft_prev;
+		if (ft->ft_map != NULL) {
+			bitmap_destroy(ft->ft_map);
+		}
+		kfree(ft->ft_ofiles);
+		kfree(ft);
+		ft = prev;
+	}
+}
+
+struct file_info *fd_get(struct proc *p, int fd){
+	struct fdtable *ft = p->p_fdt;
+
+	// Whichever table we see, its slots are all still valid
+	if (fd < 0 || fd >= ft->ft_nfiles) {
+		return NULL;
+	}
+	return ft->ft_ofiles[fd];
+}
+
+int fd_grow(struct proc *p, int fd){
+	struct fdtable *old = p->p_fdt;
+	struct fdtable *ft;
+	int nfiles;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+	if (fd < old->ft_nfiles) {
+		return 0;
+	}
+
+	nfiles = old->ft_nfiles;
+	while (nfiles <= fd) {
+		nfiles *= 2;
+	}
+	if (nfiles > OPEN_MAX) {
+		nfiles = OPEN_MAX;
+	}
+
+	ft = fdtable_create(nfiles);
+	if (ft == NULL) {
+		return ENOMEM;
+	}
+	for (int i = 0; i < old->ft_nfiles; i++) {
+		ft->ft_ofiles[i] = old->ft_ofiles[i];
+		if (i >= 3 && bitmap_isset(old->ft_map, i)) {
+			bitmap_mark(ft->ft_map, i);
+		}
+	}
+
+	// Readers may still be in the old table; it's freed with the proc
+	bitmap_destroy(old->ft_map);
+	old->ft_map = NULL;
+	ft->ft_prev = old;
+	membar_store_store();
+	p->p_fdt = ft;
+	return 0;
+}
+
+int fd_alloc(struct proc *p, int *fd){
+	unsigned index;
+	int result;
+
+	KASSERT(lock_do_i_hold(p->fd_lock));
+
+	if (bitmap_alloc(p->p_fdt->ft_map, &index) == 0) {
+		*fd = index;
+		return 0;
+	}
+	if (p->p_fdt->ft_nfiles >= OPEN_MAX) {
+		return EMFILE;
+	}
+
+	// Full: the first new slot is ours
+	index = p->p_fdt->ft_nfiles;
+	result = fd_grow(p, index);
+	if (result) {
+		return result;
+	}
+	bitmap_mark(p->p_fdt->ft_map, index);
+	*fd = index;
+	return 0;
+}
+
+void fd_install(struct proc *p, int fd, struct file_info *fh){
+	struct fdtable *ft = p->p_fdt;
+
+	KASSERT(lock_do_i_hold(p->fd_lock));
+	KASSERT(fd >= 0 && fd < ft->ft_nfiles);
+
+	if (fd >= 3) {
+		if (fh != NULL && !bitmap_isset(ft->ft_map, fd)) {
+			bitmap_mark(ft->ft_map, fd);
+		} else if (fh == NULL && bitmap_isset(ft->ft_map, fd)) {
+			bitmap_unmark(ft->ft_map, fd);
+		}
+	}
+
+	// Publish the file_info only once it's filled in
+	membar_store_store();
+	ft->ft_ofiles[fd] = fh;
 }
 
 /*
@@ -131,39 +378,26 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
-	pid_t i;
 	proc = kmalloc(sizeof(*proc));
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->pid = -1;
 	proc->fork_frame = NULL;
-
-	lock_acquire(pid_lock);
-	for(i = __PID_MIN; i < __PID_MAX; i++){
-
-		if(pid_status[i] == READY){
-			proc->pid = i;
-			pid_status[i] = RUNNING;
-
-			p_table[i] = pid_entry_create();
-
-			if (p_table[i] == NULL) {
-				kfree(proc);
-				lock_release(pid_lock);
-				return NULL;
-			}
-
-			p_table[i]->proc = proc;
-			p_table[i]->pid = i;
-			break;
-		}
+	proc->p_vfork = NULL;
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_nextsib = NULL;
+	proc->p_prevsib = NULL;
+
+	proc->pid = pid_alloc(proc);
+	if (proc->pid == -1) {
+		kfree(proc);
+		return NULL;
 	}
-	lock_release(pid_lock);
-
 
 	proc->p_name = kstrdup(name);
-	if (proc->p_name == NULL || proc->pid == -1) {
+	if (proc->p_name == NULL) {
 		pid_destroy(p_table[proc->pid]);
 		kfree(proc);
 		return NULL;
@@ -178,15 +412,21 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-	proc->fd_lock = lock_create("proc lock");
+	proc->fd_lock = lock_create("fd table");
 	if (proc->fd_lock == NULL){
 		pid_destroy(p_table[proc->pid]);
+		kfree(proc->p_name);
 		kfree(proc);
 		return NULL;
 	}
 
-	for (int i = 0; i < __OPEN_MAX; i++){
-		proc->fd[i] = NULL;
+	proc->p_fdt = fdtable_create(FDTABLE_MIN);
+	if (proc->p_fdt == NULL){
+		lock_destroy(proc->fd_lock);
+		pid_destroy(p_table[proc->pid]);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
 	}
 
 	return proc;
@@ -196,6 +436,55 @@ struct proc* proc_fork(const char* name){
 	proc = proc_create(name);
 	return proc;
 }
+
+void proc_addchild(struct proc *parent, struct proc *child){
+	KASSERT(child->p_parent == NULL);
+
+	spinlock_acquire(PID_STRIPE(child->pid));
+	KASSERT(pid_parent[child->pid] == -1);
+	pid_parent[child->pid] = parent->pid;
+	spinlock_release(PID_STRIPE(child->pid));
+
+	child->p_parent = parent;
+	child->p_prevsib = NULL;
+	child->p_nextsib = parent->p_children;
+	if (parent->p_children != NULL) {
+		parent->p_children->p_prevsib = child;
+	}
+	parent->p_children = child;
+}
+
+void proc_remchild(struct proc *child){
+	struct proc *parent = child->p_parent;
+
+	KASSERT(parent != NULL);
+
+	if (child->p_prevsib != NULL) {
+		child->p_prevsib->p_nextsib = child->p_nextsib;
+	} else {
+		KASSERT(parent->p_children == child);
+		parent->p_children = child->p_nextsib;
+	}
+	if (child->p_nextsib != NULL) {
+		child->p_nextsib->p_prevsib = child->p_prevsib;
+	}
+	child->p_parent = NULL;
+	child->p_nextsib = child->p_prevsib = NULL;
+
+	spinlock_acquire(PID_STRIPE(child->pid));
+	pid_parent[child->pid] = -1;
+	spinlock_release(PID_STRIPE(child->pid));
+}
+
+void proc_unfork(struct proc *child){
+	struct pid_entry *pe = p_table[child->pid];
+
+	if (child->p_parent != NULL) {
+		proc_remchild(child);
+	}
+	pid_destroy(pe);
+	proc_destroy(child);
+}
 /*
  * Destroy a proc structure.
  *
@@ -291,12 +580,12 @@ proc_destroy(struct proc *proc)
 
 	lock_destroy(proc->fd_lock);
 
-	for(int i = 0; i < __OPEN_MAX; i++){
+	for(int i = 0; i < proc->p_fdt->ft_nfiles; i++){
 
-		if(proc->fd[i] == NULL){
+		if(proc->p_fdt->ft_ofiles[i] == NULL){
 			continue;
 		} else {
-			struct file_info *fhandle = proc->fd[i];
+			struct file_info *fhandle = proc->p_fdt->ft_ofiles[i];
 			lock_acquire(fhandle->fd_lock);
 
 			int count = fhandle->ref_count - 1;
@@ -306,16 +595,17 @@ proc_destroy(struct proc *proc)
 			}
 
 			fhandle->ref_count = count;
-			proc->fd[i] = NULL;
+			proc->p_fdt->ft_ofiles[i] = NULL;
 
 			lock_release(fhandle->fd_lock);
 
 			if (count <= 0) {
 				fd_destroy(fhandle);
 			}
-			proc->fd[i] = NULL;
 		}
 	}
+	fdtable_destroy(proc->p_fdt);
+	proc->p_fdt = NULL;
 
 	kfree(proc->p_name);
 	kfree(proc);
@@ -327,24 +617,28 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
-	pid_counter = 0;
-	pid_lock = lock_create("pid lock");
-	if (pid_lock == NULL){
-		panic("pid lock creation failed");
+	pid_counter = __PID_MIN;
+	pid_map = bitmap_create(__PID_MAX);
+	if (pid_map == NULL){
+		panic("pid map creation failed");
+	}
+	for (int i = 0; i < __PID_MIN; i++){
+		bitmap_mark(pid_map, i);
+	}
+	spinlock_init(&pid_map_lock);
+	for (int i = 0; i < PID_NSTRIPES; i++){
+		spinlock_init(&pid_stripe_lock[i]);
 	}
-	lock_acquire(pid_lock);
 	for(int i = 0; i < __PID_MAX; i++){
 		/*pids[i] = pid_entry_create();
 		if(pids[i] == NULL){
 			panic("pid entry create failed\n");
 		}*/
+		p_table[i] = NULL;
 		pid_status[i] = READY;
 		pid_parent[i] = -1;
 		pid_waitcode[i] = -1;
 	}
-	lock_release(pid_lock);
-
-	pid_cv = cv_create("pid cv");
 
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
@@ -366,6 +660,7 @@ proc_create_runprogram(const char *name)
 	struct vnode *in;
 	struct vnode *out;
 	struct vnode *err;
+	struct file_info *stdio[3];
 	//mode_t dummy_mode = 0;
 	int result;
 	char arg[__PATH_MAX + 1] = "con:";
@@ -377,29 +672,23 @@ proc_create_runprogram(const char *name)
 		return NULL;
 	}
 
-	lock_acquire(p_table[newproc->pid]->pid_lock);
-      if (pid_parent[newproc->pid] == -1) {
-          pid_parent[newproc->pid] = curproc->pid;
-      } else {
-          panic("Already exists parent for this process");
-      }
-    lock_release(p_table[newproc->pid]->pid_lock);
+	proc_addchild(curproc, newproc);
 
 	/* VM fields */
 
 	newproc->p_addrspace = NULL;
-	newproc->fd[STDIN_FILENO] = fd_create();
-	if(newproc->fd[STDIN_FILENO] == NULL){
+	stdio[STDIN_FILENO] = fd_create();
+	if(stdio[STDIN_FILENO] == NULL){
 		return NULL;
 	}
 
-	newproc->fd[STDOUT_FILENO] = fd_create();
-	if(newproc->fd[STDOUT_FILENO] == NULL){
+	stdio[STDOUT_FILENO] = fd_create();
+	if(stdio[STDOUT_FILENO] == NULL){
 		return NULL;
 	}
 
-	newproc->fd[STDERR_FILENO] = fd_create();
-	if(newproc->fd[STDERR_FILENO] == NULL){
+	stdio[STDERR_FILENO] = fd_create();
+	if(stdio[STDERR_FILENO] == NULL){
 		return NULL;
 	}
 
@@ -409,22 +698,30 @@ proc_create_runprogram(const char *name)
 		return NULL;
 	}
 
-	newproc->fd[STDIN_FILENO]->file  = in;
-	newproc->fd[STDIN_FILENO]->status_flag = O_RDONLY;
+	stdio[STDIN_FILENO]->file  = in;
+	stdio[STDIN_FILENO]->status_flag = O_RDONLY;
 
 	result = vfs_open(arg2, O_WRONLY, 0664, &out);
 	if(result){
 		return NULL;
 	}
-	newproc->fd[STDOUT_FILENO]->file = out;
-	newproc->fd[STDOUT_FILENO]->status_flag = O_WRONLY;
+	stdio[STDOUT_FILENO]->file = out;
+	stdio[STDOUT_FILENO]->status_flag = O_WRONLY;
 
 	result = vfs_open(arg3, O_WRONLY, 0664, &err);
 	if(result){
 		return NULL;
 	}
-	newproc->fd[STDERR_FILENO]->file = err;
-	newproc->fd[STDERR_FILENO]->status_flag = O_WRONLY;
+	stdio[STDERR_FILENO]->file = err;
+	stdio[STDERR_FILENO]->status_flag = O_WRONLY;
+
+	lock_acquire(newproc->fd_lock);
+	for (int i = 0; i < 3; i++) {
+		// One reference, from this slot, same as a fresh open
+		stdio[i]->ref_count = 1;
+		fd_install(newproc, i, stdio[i]);
+	}
+	lock_release(newproc->fd_lock);
 
 	/*
 	 * Lock the current process to copy its current directory.
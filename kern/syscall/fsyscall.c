@@ -14,14 +14,85 @@
 #include <kern/fcntl.h>
 #include <stat.h>
 #include <kern/seek.h>
+#include <pipe.h>
+#include <kern/poll.h>
+#include <poll.h>
+#include <kern/time.h>
+#include <kern/ioring.h>
 
 
 /* We used struct file_info (defined in proc.h) to represent each entry of file descriptor in a file table
- * In proc structure, we added struct file_info *fd[__OPEN_MAX] to represent the file table
- * and lock *fd_lock to represent the lock to that file table
+ * In proc structure, struct fdtable *p_fdt is the file table (it grows on demand, see proc.c)
+ * and lock *fd_lock is the lock to that file table
+ *
+ * The table lock is only taken when a slot changes (open, close, dup2, fork). Lookups (read,
+ * write, lseek) take no table lock: they read the slot, lock that file_info's own fd_lock, and
+ * check the slot still holds it. file_infos are never freed, only recycled, so locking one a
+ * concurrent close just took out is harmless; we notice and look again.
+ * Lock order is table lock, then the file_info's fd_lock.
  *
 */
 
+/*
+ * Take fd out of the current process's table. Caller holds the table lock for writing.
+ * Returns NULL if the slot was empty.
+ */
+static struct file_info *fd_detach(int fd){
+	struct file_info *fhandle;
+
+	KASSERT(lock_do_i_hold(curproc->fd_lock));
+
+	fhandle = fd_get(curproc, fd);
+	if (fhandle != NULL){
+		fd_install(curproc, fd, NULL);
+	}
+	return fhandle;
+}
+
+/*
+ * Drop one reference to a detached file handle, closing the file on the last one.
+ * Must be called without the table lock.
+ */
+static void fd_release(struct file_info *fhandle){
+	int count;
+
+	lock_acquire(fhandle->fd_lock);
+
+	count = fhandle->ref_count - 1;
+	if (count <= 0) {
+		vfs_close(fhandle->file);
+	}
+	fhandle->ref_count = count;
+
+	lock_release(fhandle->fd_lock);
+
+	if (count <= 0) {
+		fd_destroy(fhandle);
+	}
+}
+
+/*
+ * Look up fd and return it with its fd_lock held, or NULL if fd isn't open.
+ * Takes no table lock.
+ */
+static struct file_info *fd_lookup(int fd){
+	struct file_info *fhandle;
+
+	for (;;){
+		fhandle = fd_get(curproc, fd);
+		if (fhandle == NULL){
+			return NULL;
+		}
+
+		lock_acquire(fhandle->fd_lock);
+		// Closed (or closed and reused) while we weren't holding anything?
+		if (fd_get(curproc, fd) == fhandle){
+			return fhandle;
+		}
+		lock_release(fhandle->fd_lock);
+	}
+}
+
 int sys_open(userptr_t user_pathname, int user_flag, int* retval)
 {
 	char *pathname;
@@ -43,51 +114,39 @@ int sys_open(userptr_t user_pathname, int user_flag, int* retval)
 	struct vnode *dummy_file;
 
 
-	//Think about case where vfs_open returns, but the index finder fails. Would this affect file?
-
-	lock_acquire(curproc->fd_lock);
-
-	// Find an available fd
-	for (int i = 3; i < __OPEN_MAX; i++){
-		if(curproc->fd[i] == NULL){
-			index = i;
-			break;
-		}
-	}
-
-	if (index == 0){
-		lock_release(curproc->fd_lock);
-		kfree(pathname);
-		return EMFILE;
+	// Open the file before touching the table, so a half-set-up fd is never visible
+	result = vfs_open(pathname, user_flag, dummy_mode, &dummy_file);
+	kfree(pathname);
+	if (result){
+		return result;
 	}
 
-	// Set fd to non-NULL to prevent unwanted access
-	curproc->fd[index] = fd_create();
-	if (curproc->fd[index] == NULL){
-		lock_release(curproc->fd_lock);
-		return EIO;
+	struct file_info *fhandle = fd_create();
+	if (fhandle == NULL){
+		vfs_close(dummy_file);
+		return ENOMEM;
 	}
 
-	// Acquire the lock within the protection of the file table's lock
-	lock_release(curproc->fd_lock);
+	// Configure the fd with the info
+	// Init ref_count
+	fhandle->status_flag = user_flag;
+	fhandle->file = dummy_file;
+	fhandle->ref_count = 1;
 
-	lock_acquire(curproc->fd[index]->fd_lock);
-	result = vfs_open(pathname, user_flag, dummy_mode, &dummy_file);
+	lock_acquire(curproc->fd_lock);
 
+	// Lowest available fd, growing the table if it's full
+	result = fd_alloc(curproc, &index);
 	if (result){
-          kfree(pathname);
-		  lock_release(curproc->fd[index]->fd_lock);
-		  return result;
- 	}
+		lock_release(curproc->fd_lock);
+		vfs_close(dummy_file);
+		fd_destroy(fhandle);
+		return result;
+	}
 
-	// Configure the fd with the info
-	// Init ref_count
-	curproc->fd[index]->status_flag = user_flag;
-	curproc->fd[index]->file = dummy_file;
-	curproc->fd[index]->ref_count = 1;
+	fd_install(curproc, index, fhandle);
+	lock_release(curproc->fd_lock);
 
-	kfree(pathname);
-	lock_release(curproc->fd[index]->fd_lock);
 	*retval = index;
 	return 0;
 }
@@ -98,15 +157,6 @@ int sys_close(int user_fd){
 		return EBADF;
 	}
 
-	lock_acquire(curproc->fd_lock);
-
-	if (curproc->fd[user_fd] == NULL){
-		lock_release(curproc->fd_lock);
-		return EBADF;
-	}
-
-	lock_release(curproc->fd_lock);
-
 	/* Since many fd can be pointing to the same file,
 	 * closing the file of one fd will only make that fd available by setting to NULL
 	 *
@@ -114,188 +164,230 @@ int sys_close(int user_fd){
 	 * and only be closed if all fd have been closed (ref_count == 0)
 	*/
 
-	struct file_info *fhandle = curproc->fd[user_fd];
-
-	lock_acquire(fhandle->fd_lock);
-
-	int count = fhandle->ref_count - 1;
+	lock_acquire(curproc->fd_lock);
+	struct file_info *fhandle = fd_detach(user_fd);
+	lock_release(curproc->fd_lock);
 
-	if (count <= 0) {
-		vfs_close(fhandle->file);
+	if (fhandle == NULL){
+		return EBADF;
 	}
 
-	fhandle->ref_count = count;
-	curproc->fd[user_fd] = NULL;
-
-	lock_release(fhandle->fd_lock);
-
-	if (count <= 0) {
-		fd_destroy(fhandle);
-	}
+	fd_release(fhandle);
 
 	return 0;
 }
 
-int sys_read(int fd, void *user_buf, size_t buflen, int* retval){
-
-//TODO: Add individual fd locks to file_info struct
-	size_t bytes_read = -1;
-
-	// Check for valid fd
-	lock_acquire(curproc->fd_lock);
+/*
+ * Look up fd and take a reference to it, without keeping its fd_lock.
+ * Drop the reference with fd_release.
+ */
+static struct file_info *fd_hold(int fd){
+	struct file_info *fhandle = fd_lookup(fd);
 
-	if(fd > (__OPEN_MAX -1) || (fd < 0)){
-		lock_release(curproc->fd_lock);
-		return EBADF; //EBADF
+	if (fhandle != NULL){
+		fhandle->ref_count++;
+		lock_release(fhandle->fd_lock);
 	}
+	return fhandle;
+}
 
-	if(curproc->fd[fd] == NULL){
-		lock_release(curproc->fd_lock);
+/*
+ * Common path of read/write and their vectored and positional forms. IOV is a
+ * kernel copy of the caller's iovecs, TOTAL the sum of their lengths.
+ *
+ * Plain I/O on a seekable file uses and advances the file's offset, under the
+ * file's fd_lock. Positional I/O goes at POS and leaves the offset alone, so it
+ * holds only a reference to the file: threads reading disjoint ranges of one
+ * file don't serialize here.
+ *
+ * Non-seekable files (pipes, the console) have no offset to protect, and I/O on
+ * them can block for as long as the other end likes, so they also get by with a
+ * reference. Holding fd_lock across a pipe_write that's waiting for room would
+ * stall close and poll on the same file_info, which a pipeline needs to make
+ * progress.
+ */
+static int fd_rw(int fd, struct iovec *iov, unsigned iovcnt, size_t total,
+		 bool positional, off_t pos, enum uio_rw rw, int32_t *retval){
+	struct file_info *fhandle;
+	struct uio u;
+	bool locked;
+	int accmode;
+	int result;
+
+	// Comes back with the fd's own lock held
+	fhandle = fd_lookup(fd);
+	if (fhandle == NULL){
 		return EBADF;
 	}
 
-	lock_release(curproc->fd_lock);
+	// Keep the lock only if we're going to use the offset
+	locked = !positional && VOP_ISSEEKABLE(fhandle->file);
+	if (!locked){
+		fhandle->ref_count++;
+		lock_release(fhandle->fd_lock);
+	}
 
-	//Check for READ permission
-	lock_acquire(curproc->fd[fd]->fd_lock);
-	int CHECK_RD;
-	int CHECK_WR;
-	int CHECK_RDWR;
+	// Check for READ or WRITE permission
+	accmode = fhandle->status_flag & O_ACCMODE;
+	if (rw == UIO_READ){
+		result = (accmode == O_WRONLY) ? EBADF : 0;
+	} else {
+		result = (accmode == O_WRONLY || accmode == O_RDWR) ? 0 : EBADF;
+	}
+	if (result == 0 && positional && !VOP_ISSEEKABLE(fhandle->file)){
+		result = ESPIPE;
+	}
+	if (result){
+		goto done;
+	}
 
-	CHECK_WR = curproc->fd[fd]->status_flag & O_WRONLY;
-	CHECK_RD = curproc->fd[fd]->status_flag & O_RDONLY;
-	CHECK_RDWR = curproc->fd[fd]->status_flag & O_RDWR;
+	// Init uio for user I/O
+	u.uio_iov = iov;
+	u.uio_iovcnt = iovcnt;
+	u.uio_resid = total;
+	u.uio_offset = positional ? pos : (locked ? fhandle->offset : 0);
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = rw;
+	u.uio_space = curproc->p_addrspace;
+
+	if (rw == UIO_READ){
+		result = VOP_READ(fhandle->file, &u);
+	} else {
+		result = VOP_WRITE(fhandle->file, &u);
+	}
+	if (result){
+		goto done;
+	}
 
-	if (CHECK_WR == O_WRONLY){
-		lock_release(curproc->fd[fd]->fd_lock);
-		return EBADF;
+	// Compute bytes transferred and update offset
+	if (locked){
+		fhandle->offset += (off_t)(total - u.uio_resid);
 	}
+	*retval = total - u.uio_resid;
 
-	if (!((CHECK_RD == O_RDONLY) || (CHECK_RDWR == O_RDWR))){
-		lock_release(curproc->fd[fd]->fd_lock);
-		return EINVAL;
+ done:
+	if (locked){
+		lock_release(fhandle->fd_lock);
+	} else {
+		fd_release(fhandle);
 	}
+	return result;
+}
 
-	struct uio read_uio;
-	struct iovec read_iov;
+/*
+ * Copy in a user iovec array for readv/writev and total it up.
+ */
+static int iov_copyin(const struct iovec *user_iov, int iovcnt,
+		      struct iovec **ret, size_t *total){
+	struct iovec *iov;
+	size_t sum = 0;
 	int result;
-	bytes_read = 0;
 
-	// Init iovec and uio for user I/O
-	read_iov.iov_ubase = (userptr_t) user_buf;
-	read_iov.iov_len = buflen;
-	read_uio.uio_iov = &read_iov;
-	read_uio.uio_iovcnt = 1;
-	read_uio.uio_resid = buflen;
-	read_uio.uio_offset = curproc->fd[fd]->offset;
-	read_uio.uio_segflg = UIO_USERSPACE;
-	read_uio.uio_rw = UIO_READ;
-	read_uio.uio_space = curproc->p_addrspace;
+	if (iovcnt <= 0 || iovcnt > IOV_MAX){
+		return EINVAL;
+	}
 
-	result = VOP_READ(curproc->fd[fd]->file, &read_uio);
+	iov = kmalloc(iovcnt * sizeof(struct iovec));
+	if (iov == NULL){
+		return ENOMEM;
+	}
 
+	result = copyin((const_userptr_t)user_iov, iov, iovcnt * sizeof(struct iovec));
 	if (result){
-		lock_release(curproc->fd[fd]->fd_lock);
+		kfree(iov);
 		return result;
 	}
 
-	// Compute bytes_read and update offset
-	bytes_read = buflen - read_uio.uio_resid;
-	curproc->fd[fd]->offset += (off_t) bytes_read;
-	lock_release(curproc->fd[fd]->fd_lock);
-
-	*retval = bytes_read;
+	// The total has to fit in the (signed) return value
+	for (int i = 0; i < iovcnt; i++){
+		if (iov[i].iov_len > (size_t)0x7fffffff - sum){
+			kfree(iov);
+			return EINVAL;
+		}
+		sum += iov[i].iov_len;
+	}
 
+	*ret = iov;
+	*total = sum;
 	return 0;
 }
 
+int sys_read(int fd, void *user_buf, size_t buflen, int* retval){
+	struct iovec read_iov;
 
+	read_iov.iov_ubase = (userptr_t) user_buf;
+	read_iov.iov_len = buflen;
+	return fd_rw(fd, &read_iov, 1, buflen, false, 0, UIO_READ, retval);
+}
 
 size_t sys_write(int fd, const void* user_buf, size_t nbytes, int32_t* retval){
+	struct iovec write_iov;
 
-	// Check for valid fd
-	lock_acquire(curproc->fd_lock);
+	write_iov.iov_ubase = (userptr_t) user_buf;
+	write_iov.iov_len = nbytes;
+	return fd_rw(fd, &write_iov, 1, nbytes, false, 0, UIO_WRITE, retval);
+}
 
-	if(fd > (__OPEN_MAX - 1) || (fd < 0)){
-		lock_release(curproc->fd_lock);
-		return EBADF;
-	}
+int sys_pread(int fd, void *user_buf, size_t buflen, off_t pos, int32_t *retval){
+	struct iovec read_iov;
 
- 	if(curproc->fd[fd] == NULL){
-		lock_release(curproc->fd_lock);
-		return EBADF;
+	if (pos < 0){
+		return EINVAL;
 	}
+	read_iov.iov_ubase = (userptr_t) user_buf;
+	read_iov.iov_len = buflen;
+	return fd_rw(fd, &read_iov, 1, buflen, true, pos, UIO_READ, retval);
+}
 
-	lock_release(curproc->fd_lock);
-
-	// Check for WRITE permission
-	lock_acquire(curproc->fd[fd]->fd_lock);
-	int CHECK_WR, CHECK_RDW;
-
-	CHECK_WR = curproc->fd[fd]->status_flag & O_WRONLY;
-	CHECK_RDW = curproc->fd[fd]->status_flag & O_RDWR;
-
+int sys_pwrite(int fd, const void *user_buf, size_t nbytes, off_t pos, int32_t *retval){
+	struct iovec write_iov;
 
-	if(!(CHECK_WR == O_WRONLY || CHECK_RDW == O_RDWR)){
-		lock_release(curproc->fd[fd]->fd_lock);
-		return EBADF; //EINVAL
+	if (pos < 0){
+		return EINVAL;
 	}
-
-	struct uio write_uio;
- 	struct iovec write_iov;
-	int result;
-	size_t bytes_written;
-
-	// Init iovec and uio for user I/O
 	write_iov.iov_ubase = (userptr_t) user_buf;
-    write_iov.iov_len = nbytes;
-    write_uio.uio_iov = &write_iov;
-    write_uio.uio_iovcnt = 1;
-    write_uio.uio_resid = nbytes;
-    write_uio.uio_offset = curproc->fd[fd]->offset;
-    write_uio.uio_segflg = UIO_USERSPACE;
-	write_uio.uio_rw = UIO_WRITE;
-    write_uio.uio_space = curproc->p_addrspace;
+	write_iov.iov_len = nbytes;
+	return fd_rw(fd, &write_iov, 1, nbytes, true, pos, UIO_WRITE, retval);
+}
 
-	result = VOP_WRITE(curproc->fd[fd]->file, &write_uio);
+int sys_readv(int fd, const struct iovec *user_iov, int iovcnt, int32_t *retval){
+	struct iovec *iov;
+	size_t total;
+	int result;
 
+	result = iov_copyin(user_iov, iovcnt, &iov, &total);
 	if (result){
-		lock_release(curproc->fd[fd]->fd_lock);
 		return result;
 	}
+	result = fd_rw(fd, iov, iovcnt, total, false, 0, UIO_READ, retval);
+	kfree(iov);
+	return result;
+}
 
-	// Compute bytes_written and update offsets
-	bytes_written = nbytes - write_uio.uio_resid;
-	curproc->fd[fd]->offset += (off_t) bytes_written;
-	*retval = bytes_written;
-	lock_release(curproc->fd[fd]->fd_lock);
+int sys_writev(int fd, const struct iovec *user_iov, int iovcnt, int32_t *retval){
+	struct iovec *iov;
+	size_t total;
+	int result;
 
-	return 0;
+	result = iov_copyin(user_iov, iovcnt, &iov, &total);
+	if (result){
+		return result;
+	}
+	result = fd_rw(fd, iov, iovcnt, total, false, 0, UIO_WRITE, retval);
+	kfree(iov);
+	return result;
 }
 
 int sys_lseek(int fd, off_t pos, int whence, int32_t* retval, int32_t* retval2){
 	// Check for valid arg
 	if (whence < 0 || whence > 2) {return EINVAL;}
 
-	// Check for valid fd
-	lock_acquire(curproc->fd_lock);
-
-	if(fd >= __OPEN_MAX || fd < 0){
-		lock_release(curproc->fd_lock);
-		return EBADF;
-	}
-
-	if(curproc->fd[fd]== NULL){
-		lock_release(curproc->fd_lock);
+	// Check for valid fd; comes back with the fd's own lock held
+	struct file_info *fhandle = fd_lookup(fd);
+	if (fhandle == NULL){
 		return EBADF;
 	}
 
-	struct file_info *fhandle = curproc->fd[fd];
-
-	lock_acquire(fhandle->fd_lock);
-
-	lock_release(curproc->fd_lock);
-
 	if (!VOP_ISSEEKABLE(fhandle->file)) {
 		lock_release(fhandle->fd_lock);
 		return ESPIPE;
@@ -404,54 +496,484 @@ int sys__getcwd(char *buf, size_t buflen, int32_t *retval) {
 int sys_dup2(int oldfd, int newfd, int32_t* retval) {
 	if (newfd < 0 || oldfd < 0 || newfd >= OPEN_MAX || oldfd >= OPEN_MAX) {return EBADF;}
 
-	struct file_info *old = curproc->fd[oldfd];
-	struct file_info *new = curproc->fd[newfd];
+	struct file_info *replaced;
+	int result;
 
 	lock_acquire(curproc->fd_lock);
 
+	struct file_info *old = fd_get(curproc, oldfd);
+
 	if (old == NULL){
 		lock_release(curproc->fd_lock);
 		return EBADF;
 	}
 
-	if (old == new) {
-		*retval = oldfd;
+	if (old == fd_get(curproc, newfd)) {
+		*retval = newfd;
 		lock_release(curproc->fd_lock);
 		return 0;
 	}
 
-	if (curproc->fd[newfd] != NULL){sys_close(newfd);}
-
-	if (curproc->fd[newfd] != NULL) {
+	// newfd may be past the end of the table so far
+	result = fd_grow(curproc, newfd);
+	if (result) {
 		lock_release(curproc->fd_lock);
-		return -1;
+		return result;
 	}
 
+	// Take whatever newfd had out of the table; it's released once we drop the table lock
+	replaced = fd_detach(newfd);
+
 	// Set newfd pointing to oldfd and increment ref_count
-	curproc->fd[newfd] = curproc->fd[oldfd];
-	curproc->fd[oldfd]->ref_count++;
+	lock_acquire(old->fd_lock);
+	old->ref_count++;
+	lock_release(old->fd_lock);
+	fd_install(curproc, newfd, old);
 
 	lock_release(curproc->fd_lock);
 
+	if (replaced != NULL) {
+		fd_release(replaced);
+	}
+
 	*retval = newfd;
 	return 0;
 }
 
+int sys_pipe(userptr_t user_fds, int32_t *retval){
+	struct vnode *rvn, *wvn;
+	struct file_info *ends[2];
+	int fds[2];
+	int result;
+
+	result = pipe_create(PIPE_SIZE, &rvn, &wvn);
+	if (result){
+		return result;
+	}
+
+	ends[0] = fd_create();
+	ends[1] = fd_create();
+	if (ends[0] == NULL || ends[1] == NULL){
+		if (ends[0] != NULL) {fd_destroy(ends[0]);}
+		if (ends[1] != NULL) {fd_destroy(ends[1]);}
+		vfs_close(rvn);
+		vfs_close(wvn);
+		return ENOMEM;
+	}
+	ends[0]->file = rvn;
+	ends[0]->status_flag = O_RDONLY;
+	ends[0]->ref_count = 1;
+	ends[1]->file = wvn;
+	ends[1]->status_flag = O_WRONLY;
+	ends[1]->ref_count = 1;
+
+	lock_acquire(curproc->fd_lock);
+	result = fd_alloc(curproc, &fds[0]);
+	if (result == 0){
+		fd_install(curproc, fds[0], ends[0]);
+		result = fd_alloc(curproc, &fds[1]);
+		if (result == 0){
+			fd_install(curproc, fds[1], ends[1]);
+		} else {
+			fd_detach(fds[0]);
+		}
+	}
+	lock_release(curproc->fd_lock);
+
+	if (result){
+		fd_release(ends[0]);
+		fd_release(ends[1]);
+		return result;
+	}
+
+	result = copyout(fds, user_fds, sizeof(fds));
+	if (result){
+		sys_close(fds[0]);
+		sys_close(fds[1]);
+		return result;
+	}
+
+	*retval = 0;
+	return 0;
+}
+
+/*
+ * Wait until one of the NFDS entries of FDS (a kernel copy) is ready or
+ * TIMEOUT_MS has passed (negative waits forever, 0 just looks). Fills in
+ * revents and hands back how many entries have any.
+ *
+ * The first scan registers with each object (VOP_POLL); after that we
+ * sleep until one of them, or the timeout, wakes us and scan again.
+ * Every file stays held until we're done, so nothing we're registered
+ * with can go away under us.
+ */
+static int do_poll(struct pollfd *fds, unsigned nfds, int timeout_ms, int *nready){
+	struct file_info **files = NULL;
+	struct pollent *ents = NULL;
+	struct pollwaiter pw;
+	bool first = true;
+	unsigned i;
+	int n, result;
+
+	if (nfds > 0){
+		files = kmalloc(nfds * sizeof(struct file_info *));
+		ents = kmalloc(nfds * sizeof(struct pollent));
+		if (files == NULL || ents == NULL){
+			kfree(files);
+			kfree(ents);
+			return ENOMEM;
+		}
+	}
+
+	result = pollwaiter_init(&pw, timeout_ms);
+	if (result){
+		kfree(files);
+		kfree(ents);
+		return result;
+	}
+
+	for (i = 0; i < nfds; i++){
+		pollent_init(&ents[i], &pw);
+		files[i] = fds[i].fd < 0 ? NULL : fd_hold(fds[i].fd);
+	}
+
+	for (;;){
+		pollwaiter_reset(&pw);
+		n = 0;
+		for (i = 0; i < nfds; i++){
+			fds[i].revents = 0;
+			if (fds[i].fd < 0){
+				continue;
+			}
+			if (files[i] == NULL){
+				fds[i].revents = POLLNVAL;
+			} else {
+				fds[i].revents = VOP_POLL(files[i]->file, fds[i].events,
+					(first && timeout_ms != 0) ? &ents[i] : NULL);
+			}
+			if (fds[i].revents != 0){
+				n++;
+			}
+		}
+		first = false;
+
+		if (n > 0 || timeout_ms == 0){
+			break;
+		}
+		if (!pollwaiter_sleep(&pw)){
+			// Timed out
+			break;
+		}
+	}
+
+	for (i = 0; i < nfds; i++){
+		pollent_unregister(&ents[i]);
+		if (files[i] != NULL){
+			fd_release(files[i]);
+		}
+	}
+	pollwaiter_cleanup(&pw);
+	kfree(files);
+	kfree(ents);
+
+	*nready = n;
+	return 0;
+}
+
+int sys_poll(userptr_t user_fds, unsigned nfds, int timeout, int32_t *retval){
+	struct pollfd *fds = NULL;
+	int result;
+
+	if (nfds > OPEN_MAX){
+		return EINVAL;
+	}
+
+	if (nfds > 0){
+		fds = kmalloc(nfds * sizeof(struct pollfd));
+		if (fds == NULL){
+			return ENOMEM;
+		}
+		result = copyin(user_fds, fds, nfds * sizeof(struct pollfd));
+		if (result){
+			kfree(fds);
+			return result;
+		}
+	}
+
+	result = do_poll(fds, nfds, timeout < 0 ? -1 : timeout, retval);
+	if (result == 0 && nfds > 0){
+		result = copyout(fds, user_fds, nfds * sizeof(struct pollfd));
+	}
+	kfree(fds);
+	return result;
+}
+
+#define FDSET_ISSET(set, fd) (((set)->fds_bits[(fd) / 32] >> ((fd) % 32)) & 1)
+#define FDSET_SET(set, fd) ((set)->fds_bits[(fd) / 32] |= 1U << ((fd) % 32))
+
+/*
+ * select, on top of do_poll: the three sets become one pollfd per fd
+ * that's in any of them, and the results are folded back into the sets.
+ */
+int sys_select(int nfds, userptr_t user_sets[3], userptr_t user_timeout, int32_t *retval){
+	static const int setevents[3] = { POLLIN, POLLOUT, POLLPRI };
+	static const int setready[3] = {
+		POLLIN | POLLHUP | POLLERR, POLLOUT | POLLERR, POLLPRI
+	};
+	fd_set sets[3];
+	struct pollfd *fds;
+	struct timeval tv;
+	size_t setbytes;
+	unsigned npoll = 0;
+	int timeout_ms = -1;
+	int i, fd, events, n;
+	int result;
 
+	if (nfds < 0 || nfds > __FD_SETSIZE){
+		return EINVAL;
+	}
 
+	// Only the words covering fds below nfds are read or written
+	setbytes = ((nfds + 31) / 32) * sizeof(__u32);
+	for (i = 0; i < 3; i++){
+		bzero(&sets[i], sizeof(fd_set));
+		if (user_sets[i] != NULL && setbytes > 0){
+			result = copyin(user_sets[i], &sets[i], setbytes);
+			if (result){
+				return result;
+			}
+		}
+	}
 
+	if (user_timeout != NULL){
+		result = copyin(user_timeout, &tv, sizeof(tv));
+		if (result){
+			return result;
+		}
+		if (tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000){
+			return EINVAL;
+		}
+		timeout_ms = tv.tv_sec > 0x7fffffff / 1000 - 1 ? 0x7fffffff :
+			(int)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
 
+	fds = kmalloc((nfds > 0 ? nfds : 1) * sizeof(struct pollfd));
+	if (fds == NULL){
+		return ENOMEM;
+	}
+	for (fd = 0; fd < nfds; fd++){
+		events = 0;
+		for (i = 0; i < 3; i++){
+			if (FDSET_ISSET(&sets[i], fd)){
+				events |= setevents[i];
+			}
+		}
+		if (events != 0){
+			fds[npoll].fd = fd;
+			fds[npoll].events = events;
+			npoll++;
+		}
+	}
+
+	result = do_poll(fds, npoll, timeout_ms, &n);
+	if (result){
+		kfree(fds);
+		return result;
+	}
+
+	n = 0;
+	for (i = 0; i < 3; i++){
+		bzero(&sets[i], sizeof(fd_set));
+	}
+	for (unsigned j = 0; j < npoll; j++){
+		if (fds[j].revents & POLLNVAL){
+			kfree(fds);
+			return EBADF;
+		}
+		for (i = 0; i < 3; i++){
+			if ((fds[j].events & setevents[i]) && (fds[j].revents & setready[i])){
+				FDSET_SET(&sets[i], fds[j].fd);
+				n++;
+			}
+		}
+	}
+	kfree(fds);
+
+	for (i = 0; i < 3; i++){
+		if (user_sets[i] != NULL && setbytes > 0){
+			result = copyout(&sets[i], user_sets[i], setbytes);
+			if (result){
+				return result;
+			}
+		}
+	}
+
+	*retval = n;
+	return 0;
+}
+
+/*
+ * Batched I/O ring (see kern/ioring.h). One trap runs up to a whole
+ * ring's worth of small reads and writes; the entries are brought in
+ * and the completions sent out IORING_BATCH at a time, with one copyin
+ * and one copyout each.
+ */
+#define IORING_BATCH 32
+
+/*
+ * Run one submission queue entry, through the same calls the single
+ * syscalls use, and fill in its completion.
+ */
+static void ioring_run(const struct io_sqe *sqe, struct io_cqe *cqe){
+	int32_t ret = 0, ret2 = 0;
+	off_t res = 0;
+	int err;
+
+	switch (sqe->sqe_op){
+	    case IORING_OP_NOP:
+		err = 0;
+		break;
 
+	    case IORING_OP_READ:
+		err = sys_read(sqe->sqe_fd, (void *)sqe->sqe_buf, sqe->sqe_len, &ret);
+		res = ret;
+		break;
 
+	    case IORING_OP_WRITE:
+		err = sys_write(sqe->sqe_fd, (const void *)sqe->sqe_buf, sqe->sqe_len, &ret);
+		res = ret;
+		break;
 
+	    case IORING_OP_PREAD:
+		err = sys_pread(sqe->sqe_fd, (void *)sqe->sqe_buf, sqe->sqe_len,
+				sqe->sqe_off, &ret);
+		res = ret;
+		break;
 
+	    case IORING_OP_PWRITE:
+		err = sys_pwrite(sqe->sqe_fd, (const void *)sqe->sqe_buf, sqe->sqe_len,
+				 sqe->sqe_off, &ret);
+		res = ret;
+		break;
 
+	    case IORING_OP_LSEEK:
+		err = sys_lseek(sqe->sqe_fd, sqe->sqe_off, sqe->sqe_whence, &ret, &ret2);
+		res = ((off_t)ret << 32) | (uint32_t)ret2;
+		break;
 
+	    case IORING_OP_CLOSE:
+		err = sys_close(sqe->sqe_fd);
+		break;
 
+	    default:
+		err = EINVAL;
+		break;
+	}
 
+	cqe->cqe_res = err ? -1 : res;
+	cqe->cqe_data = sqe->sqe_data;
+	cqe->cqe_err = err;
+}
 
+/*
+ * Run up to to_submit queued entries of the ring at user_ring, in order.
+ * Stops early when the submission queue runs dry or the completion
+ * queue fills. Errors of the individual calls go in their completions;
+ * the call itself fails only when the ring can't be read or updated.
+ * Returns how many entries were consumed.
+ */
+int sys_ioring_enter(userptr_t user_ring, unsigned to_submit, int32_t *retval){
+	struct io_ring ring;
+	struct io_sqe *sqes;
+	struct io_cqe *cqes;
+	userptr_t user_heads;
+	uint32_t mask, avail, space, n, done, chunk, sqslot, cqslot;
+	int result, err;
+
+	result = copyin(user_ring, &ring, sizeof(ring));
+	if (result){
+		return result;
+	}
+	if (ring.ir_entries == 0 || ring.ir_entries > IORING_MAX ||
+	    (ring.ir_entries & (ring.ir_entries - 1)) != 0){
+		return EINVAL;
+	}
+	mask = ring.ir_entries - 1;
 
+	// Counters that don't make sense mean the ring was scribbled on
+	avail = ring.ir_sqtail - ring.ir_sqhead;
+	space = ring.ir_entries - (ring.ir_cqtail - ring.ir_cqhead);
+	if (avail > ring.ir_entries || space > ring.ir_entries){
+		return EINVAL;
+	}
 
+	n = to_submit;
+	if (n > avail){
+		n = avail;
+	}
+	if (n > space){
+		n = space;
+	}
+	if (n == 0){
+		*retval = 0;
+		return 0;
+	}
 
+	sqes = kmalloc(IORING_BATCH * sizeof(struct io_sqe));
+	cqes = kmalloc(IORING_BATCH * sizeof(struct io_cqe));
+	if (sqes == NULL || cqes == NULL){
+		kfree(sqes);
+		kfree(cqes);
+		return ENOMEM;
+	}
 
+	for (done = 0; done < n; done += chunk){
+		// Stay within one batch, and don't run off the end of either queue
+		sqslot = ring.ir_sqhead & mask;
+		cqslot = ring.ir_cqtail & mask;
+		chunk = n - done;
+		if (chunk > IORING_BATCH){
+			chunk = IORING_BATCH;
+		}
+		if (chunk > ring.ir_entries - sqslot){
+			chunk = ring.ir_entries - sqslot;
+		}
+		if (chunk > ring.ir_entries - cqslot){
+			chunk = ring.ir_entries - cqslot;
+		}
 
+		result = copyin(ring.ir_sq + sqslot * sizeof(struct io_sqe), sqes,
+				chunk * sizeof(struct io_sqe));
+		if (result){
+			break;
+		}
+		for (uint32_t i = 0; i < chunk; i++){
+			ioring_run(&sqes[i], &cqes[i]);
+		}
+		// These entries have run; consume them even if the results can't be posted
+		ring.ir_sqhead += chunk;
+		result = copyout(cqes, ring.ir_cq + cqslot * sizeof(struct io_cqe),
+				 chunk * sizeof(struct io_cqe));
+		if (result){
+			break;
+		}
+		ring.ir_cqtail += chunk;
+	}
+	kfree(sqes);
+	kfree(cqes);
+
+	/*
+	 * Publish the kernel's two counters (they sit together after the
+	 * process's), even after a fault, so the process can see what ran.
+	 */
+	user_heads = user_ring + ((char *)&ring.ir_sqhead - (char *)&ring);
+	err = copyout(&ring.ir_sqhead, user_heads, 2 * sizeof(uint32_t));
+	if (result == 0){
+		result = err;
+	}
+	if (result){
+		return result;
+	}
+	*retval = done;
+	return 0;
+}
@@ -14,6 +14,7 @@
 #include <kern/fcntl.h>
 #include <stat.h>
 #include <kern/seek.h>
+#include <kern/wait.h>
 #include <kern/psyscall.h>
 #include <addrspace.h>
 
@@ -21,13 +22,11 @@
 
 
 pid_t sys_getpid(){
-	lock_acquire(pid_lock);
+	// A process's pid never changes while it runs, so no table lock is needed
 	if (curproc == NULL) {
-		lock_release(pid_lock);
 		return -1;
 	}
 
-	lock_release(pid_lock);
 	return curproc->pid;
 }
 
@@ -35,8 +34,71 @@ static void enter_fork(void *arg_ptr, unsigned long int nargs){
 	enter_forked_process((struct trapframe*)arg_ptr, (struct addrspace*)nargs);
 }
 
-int sys_fork(struct trapframe* parent_tf, pid_t *retval){
+// Give CHILD our open files and cwd. For i < NMAP, child fd i is our
+// fd MAP[i] (or closed if that is -1); the rest are inherited as is.
+// Files are shared, not duplicated, so offsets are shared too.
+static int proc_inherit(struct proc *child, const int *map, int nmap){
+	struct file_info *file;
+	int nfiles;
+	int i;
+	int result;
+
+	lock_acquire(curproc->fd_lock);
+	for (i = 0; i < nmap; i++){
+		if (map[i] == -1) {continue;}
+		if (fd_get(curproc, map[i]) == NULL){
+			lock_release(curproc->fd_lock);
+			return EBADF;
+		}
+	}
+
+	// The child isn't running yet, but fd_install wants its table lock
+	lock_acquire(child->fd_lock);
+	nfiles = curproc->p_fdt->ft_nfiles;
+	if (nmap > nfiles) {nfiles = nmap;}
+	result = fd_grow(child, nfiles - 1);
+	if (result){
+		lock_release(child->fd_lock);
+		lock_release(curproc->fd_lock);
+		return result;
+	}
+	for (i = 0; i < nfiles; i++){
+		file = (i < nmap) ? (map[i] == -1 ? NULL : fd_get(curproc, map[i])) : fd_get(curproc, i);
+		//if parent fd entry exists, copy it over
+		//NOTE: this form of copying will allow for file mods to reflect in both procs. Not a deepcopy
+		if (file != NULL){
+			lock_acquire(file->fd_lock);
+			file->ref_count++;
+			lock_release(file->fd_lock);
+
+			fd_install(child, i, file);
+		}
+	}
+	lock_release(child->fd_lock);
+	lock_release(curproc->fd_lock);
+
+	// Before the child can run
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwd != NULL) {
+		child->p_cwd = curproc->p_cwd;
+		VOP_INCREF(curproc->p_cwd);
+	}
+	spinlock_release(&curproc->p_lock);
+
+	return 0;
+}
+
+// Shared by fork and vfork; hands back the child's pid. With BORROW the
+// child runs in our address space instead of a copy of it, *BORROW gets
+// its p_vfork semaphore, and the caller must wait on that before going
+// back to user mode.
+//
+// Everything we hand back is read before thread_fork: once the child is
+// running it may exec or exit, and clear p_vfork, before we look again.
+static int fork_common(struct trapframe* parent_tf, struct semaphore **borrow, pid_t *ret){
 	struct proc *child;
+	struct semaphore *sem = NULL;
+	pid_t pid;
 	struct trapframe *child_tf;
 	//struct addrspace *child_as;
 	int result;
@@ -52,37 +114,40 @@ int sys_fork(struct trapframe* parent_tf, pid_t *retval){
 
 	child->fork_frame = child_tf;
 
-	lock_acquire(p_table[child->pid]->pid_lock);
-	if (pid_parent[child->pid] == -1) {
-		pid_parent[child->pid] = curproc->pid;
+	proc_addchild(curproc, child);
+
+	if (borrow) {
+		child->p_addrspace = curproc->p_addrspace;
+		sem = sem_create("vfork", 0);
+		child->p_vfork = sem;
+		if (sem == NULL) {
+			child->p_addrspace = NULL;
+			kfree(child_tf);
+			proc_unfork(child);
+			return ENOMEM;
+		}
 	} else {
-		panic("Already exists parent for this process");
+		//Not sure about this
+		result = as_copy(curproc->p_addrspace, &(child->p_addrspace));
+		if (result){
+			kfree(child_tf);
+			proc_unfork(child);
+			return result;
+		}
 	}
-	lock_release(p_table[child->pid]->pid_lock);
 
-	//Not sure about this
-	result = as_copy(curproc->p_addrspace, &(child->p_addrspace));
+	result = proc_inherit(child, NULL, 0);
 	if (result){
+		if (borrow) {
+			sem_destroy(child->p_vfork);
+			child->p_vfork = NULL;
+			child->p_addrspace = NULL;
+		}
 		kfree(child_tf);
-		proc_destroy(child);
-		pid_parent[child->pid] = -1;
+		proc_unfork(child);
 		return result;
 	}
 
-	lock_acquire(curproc->fd_lock);
-	for (int i = 0; i < __OPEN_MAX; i++){
-		//if parent fd entry exists, copy it over
-		//NOTE: this form of copying will allow for file mods to reflect in both procs. Not a deepcopy
-		if (curproc->fd[i] != NULL){
-			child->fd[i] = curproc->fd[i];
-
-			lock_acquire(curproc->fd[i]->fd_lock);
-			curproc->fd[i]->ref_count++;
-			lock_release(curproc->fd[i]->fd_lock);
-		}
-	}
-	lock_release(curproc->fd_lock);
-
 	//copy trapframe over
 	memcpy((void *) child_tf, (const void *) parent_tf, sizeof(struct trapframe));
 	child_tf->tf_v0 = 0;
@@ -90,58 +155,90 @@ int sys_fork(struct trapframe* parent_tf, pid_t *retval){
 	child_tf->tf_a3 = 0;
 	child_tf->tf_epc += 4;
 
-	*retval = 0;
+	pid = child->pid;
 	result = thread_fork(child->p_name, child, enter_fork, (void*)child_tf, 0);
 	if (result){
-		//NOTE: maybe lock pid_parent write
-		pid_parent[child->pid] = -1;
+		if (borrow) {
+			sem_destroy(child->p_vfork);
+			child->p_vfork = NULL;
+			child->p_addrspace = NULL;
+		}
 		kfree(child_tf);
-		proc_destroy(child);
+		proc_unfork(child);
 		return result;
 	}
 
-	spinlock_acquire(&curproc->p_lock);
-	if (curproc->p_cwd != NULL) {
-		child->p_cwd = curproc->p_cwd;
-		VOP_INCREF(curproc->p_cwd);
+	if (borrow) {
+		*borrow = sem;
 	}
-	spinlock_release(&curproc->p_lock);
+	*ret = pid;
+	return 0;
+}
 
-	*retval = child->pid;
+int sys_fork(struct trapframe* parent_tf, pid_t *retval){
+	pid_t pid;
+	int result;
+
+	*retval = 0;
+	result = fork_common(parent_tf, NULL, &pid);
+	if (result) {return result;}
+
+	*retval = pid;
 	return 0;
 }
 
+int sys_vfork(struct trapframe* parent_tf, pid_t *retval){
+	struct semaphore *sem;
+	pid_t pid;
+	int result;
+
+	*retval = 0;
+	result = fork_common(parent_tf, &sem, &pid);
+	if (result) {return result;}
+
+	*retval = pid;
+
+	// Sleep until the child has exec'd or exited and is off our
+	// address space. The child may already be past that: the semaphore
+	// then just has its count, and only we ever destroy it.
+	P(sem);
+	sem_destroy(sem);
+	return 0;
+}
+
+// A vfork child is done with its parent's address space (it has a new
+// one from execv, or is exiting): let the parent go.
+static void vfork_release(struct proc *p){
+	struct semaphore *sem = p->p_vfork;
+
+	if (sem == NULL) {return;}
+	p->p_vfork = NULL;
+	V(sem);
+}
+
 int sys_waitpid(pid_t pid, int *status, int options) {
 	int exitcode;
-	bool is_child = pid_parent[pid] == curproc->pid ? true : false;
 	int result;
-	//Check is curproc is parent
-	if (is_child == false) {return ECHILD;}
-
-	//Invalid argument
-	if (options != 0) {return EINVAL;}
+	struct pid_entry *pe;
 
-	bool is_ready;
 	//PID arg not in bounds
-	lock_acquire(pid_lock);
-		is_ready = (pid_status[pid] == READY);
-	lock_release(pid_lock);
+	if (pid < __PID_MIN || pid >= __PID_MAX) {return ESRCH;}
 
+	//Invalid argument
+	if (options != 0) {return EINVAL;}
 
-	if (is_ready
-		|| pid < __PID_MIN
-		|| pid > __PID_MAX)
-	{
-		return ESRCH;
-	}
+	//Must exist and be our child
+	result = pid_getchild(pid, curproc, &pe);
+	if (result) {return result;}
 
-	lock_acquire(pid_lock);
+	// Only this pid's own lock and cv; nobody else's exit touches them
+	lock_acquire(pe->pid_lock);
 	while (pid_status[pid] != ZOMBIE) {
-		cv_wait(pid_cv, pid_lock);
+		cv_wait(pe->pid_cv, pe->pid_lock);
 	}
 
 	exitcode = pid_waitcode[pid];
-	lock_release(pid_lock);
+	lock_release(pe->pid_lock);
 
 	if (status != NULL) {
 		result = copyout(&exitcode, (userptr_t) status, sizeof(int));
@@ -153,307 +250,410 @@ int sys_waitpid(pid_t pid, int *status, int options) {
 
 void sys__exit(int exitcode) {
 	int parent = curproc->pid;
-
-	lock_acquire(pid_lock);
-	// Update children
-	for (int i = 0; i < PID_MAX; i++) {
-		if (p_table[i] != NULL){
-			if (pid_parent[i] == parent){
-				//if running, now orphan
-				if (pid_status[i] == RUNNING){
-					pid_status[i] = ORPHAN;
-				//if dead,
-				} else if (pid_status[i] == ZOMBIE) {
-					proc_destroy(p_table[i]->proc);
-					pid_destroy(p_table[i]);
-					p_table[i] = NULL;
-				} else {
-					panic("Forget to update somewhere");
-				}
-			}
+	struct pid_entry *self = p_table[parent];
+	struct pid_entry *pe;
+	struct proc *child;
+	pid_t cpid;
+	bool orphan;
+
+	// A vfork child never exec'd: hand the address space back
+	if (curproc->p_vfork != NULL) {
+		proc_setas(NULL);
+		vfork_release(curproc);
+	}
+
+	// Update children; only our own, not the whole table. Each
+	// child's own lock orders this against that child's exit.
+	while ((child = curproc->p_children) != NULL) {
+		cpid = child->pid;
+		pe = p_table[cpid];
+		proc_remchild(child);
+
+		lock_acquire(pe->pid_lock);
+		//if running, now orphan
+		if (pid_status[cpid] == RUNNING){
+			pid_status[cpid] = ORPHAN;
+			lock_release(pe->pid_lock);
+		//if dead,
+		} else if (pid_status[cpid] == ZOMBIE) {
+			lock_release(pe->pid_lock);
+			proc_destroy(child);
+			pid_destroy(pe);
+		} else {
+			panic("Forget to update somewhere");
 		}
 	}
 
-	//If parent still alive, update exitcode
-	if (pid_status[parent] == RUNNING) {
-		kfree(p_table[parent]->proc->fork_frame);
-		p_table[parent]->proc->fork_frame = NULL;
+	kfree(curproc->fork_frame);
+	curproc->fork_frame = NULL;
+
+	lock_acquire(self->pid_lock);
+	orphan = (pid_status[parent] == ORPHAN);
+	//If parent still alive, update exitcode and wake it if it's waiting
+	if (!orphan) {
+		KASSERT(pid_status[parent] == RUNNING);
 		pid_status[parent] = ZOMBIE;
 		pid_waitcode[parent] = exitcode;
+		cv_broadcast(self->pid_cv, self->pid_lock);
+	}
+	lock_release(self->pid_lock);
 
 	//If orphaned, just destroy entry since no one is waiting on exitcode
-	} else if (pid_status[parent] == ORPHAN) {
-		kfree(p_table[parent]->proc->fork_frame);
-		p_table[parent]->proc->fork_frame = NULL;
-		proc_destroy(p_table[parent]->proc);
-		pid_destroy(p_table[parent]);
-		p_table[parent] = NULL;
+	if (orphan) {
+		proc_destroy(curproc);
+		pid_destroy(self);
 	}
 
-	cv_broadcast(pid_cv, pid_lock);
-	lock_release(pid_lock);
 	thread_exit();
 }
 
-void sys_execv(const char *uprogram, char **uargs, int *retval){
+// An exec image staged in kernel memory: the opened program, and its
+// arguments and environment already laid out as they will sit at the top
+// of the new user stack. execv loads it into the calling process; spawn
+// hands it to the new child.
+//
+// The image is the argv pointers and a NULL, the envp pointers and a NULL,
+// then the strings. Until the stack address is known, each pointer holds
+// the offset of its string in the image; execargs_load relocates them and
+// copies the whole image out at once.
+struct execargs {
+	char *prog;
+	char *image;
+	size_t imagesize;	// bytes allocated
+	size_t len;		// bytes used
+	size_t argc;
+	size_t envc;
+	size_t envoff;		// where the envp pointers start, or 0 for none
+	struct vnode *v;
+};
 
-	char **kargv = (char**)kmalloc(ARG_MAX - PATH_MAX);
-	char *prog = (char*)kmalloc(PATH_MAX);
+static void execargs_cleanup(struct execargs *ea){
+	if (ea->v != NULL) {vfs_close(ea->v);}
+	kfree(ea->image);
+	kfree(ea->prog);
+}
 
-	if(kargv == NULL || prog == NULL){
-		*retval = ENOMEM;
-		return;
-	}
+// Make room for NEED bytes of image. It starts at a page and doubles, so
+// the usual short command line never costs an ARG_MAX allocation.
+static int execargs_reserve(struct execargs *ea, size_t need){
+	size_t size;
+	char *image;
+
+	if (need <= ea->imagesize) {return 0;}
+	if (need > ARG_MAX) {return E2BIG;}
+
+	size = ea->imagesize > 0 ? ea->imagesize : PAGE_SIZE;
+	while (size < need) {size *= 2;}
+	if (size > ARG_MAX) {size = ARG_MAX;}
+
+	image = kmalloc(size);
+	if (image == NULL) {return ENOMEM;}
+	if (ea->len > 0) {memcpy(image, ea->image, ea->len);}
+	kfree(ea->image);
+	ea->image = image;
+	ea->imagesize = size;
+	return 0;
+}
 
-	uint32_t follower;
+// Append the user pointer vector UVEC, through its NULL, to the image and
+// count its entries. It comes in a page at a time rather than a pointer at
+// a time; a copyin never crosses into the page after the NULL, so it can't
+// fault on memory the caller didn't hand us.
+static int execargs_copyvec(struct execargs *ea, const_userptr_t uvec, size_t *count){
+	vaddr_t p = (vaddr_t)uvec;
+	vaddr_t *slots;
+	size_t n = 0, chunk, i;
 	int result;
-	size_t ustr_size = 0;
-	size_t path_size = 0;
-	size_t actual = 0;
-	size_t total_buf_size = 0;;
-	size_t j = 0;
-	struct vnode *v;
-	vaddr_t entrypoint, user_stack;
-	struct addrspace *as;
-	*retval = 0;
-
 
-	if(uprogram == NULL || uargs == NULL){
-		*retval = EFAULT;
-		return;
-	}
-
-	//copyin name
-	result= copyinstr((const_userptr_t)uprogram, prog, PATH_MAX, &path_size);
-	if(result){
-		//kfree(kargv);
-		kfree(kargv);
-		kfree(prog);
-		*retval = result;
-		return;
-	}
+	if (p % sizeof(vaddr_t) != 0) {return EFAULT;}
 
-	size_t path_length;
-	path_length = (size_t)get_size(prog);
-	if(path_length == 0){
-		//kfree(kargv);
-		kfree(kargv);
-		kfree(prog);
-		*retval = EINVAL;
-		return;
-	}
+	while (1) {
+		chunk = (PAGE_SIZE - (p & (PAGE_SIZE - 1))) / sizeof(vaddr_t);
+		if (chunk > (ARG_MAX - ea->len) / sizeof(vaddr_t)) {
+			chunk = (ARG_MAX - ea->len) / sizeof(vaddr_t);
+		}
+		if (chunk == 0) {return E2BIG;}
 
-	result = copyin((const_userptr_t)&uargs[0], &kargv[0], ADDR_MIPS);
-	if(result){
-		//kfree(kargv);
-		kfree(kargv);
-		kfree(prog);
-		*retval = result;
-		return;
-	}
+		result = execargs_reserve(ea, ea->len + chunk * sizeof(vaddr_t));
+		if (result) {return result;}
 
+		slots = (vaddr_t *)(ea->image + ea->len);
+		result = copyin((const_userptr_t)p, slots, chunk * sizeof(vaddr_t));
+		if (result) {return result;}
 
-	size_t l = 0;
-	while(uargs[l] != NULL){
-		result = copyin((const_userptr_t) &uargs[l], &kargv[l], ADDR_MIPS);
-		if(result){
-			kfree(kargv);
-			kfree(prog);
-			*retval = result;
-			return;
-		}
-		l++;
-	}
-
-	l = 0;
-	while(uargs[l] != NULL){
-		result = copyin((const_userptr_t) uargs[l], kargv[l], ADDR_MIPS);
-		if(result){
-			//kfree(kargv);
-			kfree(kargv);
-			kfree(prog);
-			*retval = result;
-			return;
+		for (i = 0; i < chunk; i++) {
+			if (slots[i] == 0) {
+				ea->len += (i + 1) * sizeof(vaddr_t);
+				*count = n + i;
+				return 0;
+			}
 		}
-		l++;
-	}
-
-	//kfree(tempargs);
-	//counting number of args
-	l = 0;
-	while(uargs[l] != NULL){
-		l++;
+		ea->len += chunk * sizeof(vaddr_t);
+		n += chunk;
+		p += chunk * sizeof(vaddr_t);
 	}
+}
 
-	/*char **kargv = (char**)kmalloc(ARG_MAX);
-	if(kargv == NULL){
-		*retval = ENOMEM;
-		return;
-	}*/
-
-	//adding array pointer portion of kernel buffer to total size
-	total_buf_size += l*sizeof(char*) + 4;
-
-	//init an array that holds kernel buffer block sizes
-	//size_t kbuf_block_sizes[l];
-	size_t *kbuf_block_sizes = kmalloc(l*sizeof(size_t));
-
-	//packing in strings & setting pointers in kernel buffer accordingly
-	for(j = 0; j < l; j++){
-
-		//if j != 0, we use follower pointer to set alignment
-		if(j > 0){
-			//+1 because string is 0-term'd (size of 1 char)
-			kargv[j] = (char*)(follower + (size_t)get_size(uargs[j-1]) +1);
-
-		//for j = 0, we must start from beginning of kernel buffer
-		}else{
-			//+4 because array is null-term'd (size of 1 char *)
-			kargv[j] = (char*) ((uint32_t)&kargv[0] + l*sizeof(char*) +4);
-			kbuf_block_sizes[j] = (size_t)l*sizeof(char*) + 4;
+// Copy the COUNT strings named by the vector at offset VEC of the image
+// straight onto the end of the image, turning each pointer into the
+// offset of its copy.
+static int execargs_copystrs(struct execargs *ea, size_t vec, size_t count){
+	vaddr_t ustr;
+	size_t got;
+	int result;
 
+	for (size_t i = 0; i < count; i++) {
+		ustr = ((vaddr_t *)(ea->image + vec))[i];
+		while (1) {
+			if (ea->len < ea->imagesize) {
+				result = copyinstr((const_userptr_t)ustr, ea->image + ea->len,
+						   ea->imagesize - ea->len, &got);
+				if (result != ENAMETOOLONG) {break;}
+			}
+			// Out of room: grow and take this string again
+			if (ea->imagesize >= ARG_MAX) {return E2BIG;}
+			result = execargs_reserve(ea, ea->imagesize + 1);
+			if (result) {return result;}
 		}
+		if (result) {return result;}
 
-		/*4B boundary aligning*/
-		uint32_t temp = (size_t)kargv[j];
-
-		//Checking alignment
-		while(temp % 4 != 0){
-			temp += 1;
+		((vaddr_t *)(ea->image + vec))[i] = ea->len;
+		ea->len += got;
+	}
+	return 0;
+}
 
-		}
+// Copy in the program name, arguments and (if UENV isn't NULL) the
+// environment, and open the program.
+static int execargs_copyin(const char *uprogram, char **uargs, char **uenv, struct execargs *ea){
+	size_t path_size;
+	int result;
 
-		//setting buffer pointer & follower pointer for next iteration
-		kargv[j] = (char *)temp;
-		follower = (size_t)kargv[j];
+	ea->prog = NULL;
+	ea->image = NULL;
+	ea->imagesize = 0;
+	ea->len = 0;
+	ea->argc = 0;
+	ea->envc = 0;
+	ea->envoff = 0;
+	ea->v = NULL;
 
+	if(uprogram == NULL || uargs == NULL){
+		return EFAULT;
 	}
 
-	//setting null-term
-	kargv[l] = NULL;
-	j = 0;
-	//setting rest of block size array and copying in strings from user buffer
-	for(j = 0; j < l; j++){
-		//getting size of user string to pass into copinstr
-		ustr_size = (size_t)get_size(uargs[j]);
-		ustr_size++; //(+1 for 0-term)
+	ea->prog = kmalloc(PATH_MAX);
+	if(ea->prog == NULL){
+		return ENOMEM;
+	}
 
-		if(j > 0){
-			kbuf_block_sizes[j] = (size_t)kargv[j] - (size_t)kargv[j-1];
-			total_buf_size += kbuf_block_sizes[j]; //need to account for 0-term
-		}
-		result = copyinstr((const_userptr_t)(uargs[j]), (kargv[j]), ustr_size, &actual);
-		if(result){
-			kfree(kargv);
-			kfree(prog);
-			kfree(kbuf_block_sizes);
-			*retval = result;
-			return;
-		}
+	//copyin name
+	result = copyinstr((const_userptr_t)uprogram, ea->prog, PATH_MAX, &path_size);
+	if(result){
+		execargs_cleanup(ea);
+		return result;
+	}
+	if(ea->prog[0] == '\0'){
+		execargs_cleanup(ea);
+		return EINVAL;
+	}
 
-		//need to do this, otherwise last argument's bytecount isn't added to total_buf_size
-		if(j == (l - 1)){
-			while(actual % 4 != 0){
-				actual++;
-			}
-			total_buf_size += actual;
-		}
+	//the pointer vectors first, so the strings can go straight in after them
+	result = execargs_copyvec(ea, (const_userptr_t)uargs, &ea->argc);
+	if(result == 0 && uenv != NULL){
+		ea->envoff = ea->len;
+		result = execargs_copyvec(ea, (const_userptr_t)uenv, &ea->envc);
+	}
+	if(result == 0){
+		result = execargs_copystrs(ea, 0, ea->argc);
+	}
+	if(result == 0 && uenv != NULL){
+		result = execargs_copystrs(ea, ea->envoff, ea->envc);
+	}
+	if(result){
+		execargs_cleanup(ea);
+		return result;
 	}
 
 	//open program file
-	result = vfs_open(prog, O_RDONLY, 0, &v);
+	result = vfs_open(ea->prog, O_RDONLY, 0, &ea->v);
 	if(result){
-		kfree(kargv);
-		kfree(prog);
-		kfree(kbuf_block_sizes);
-		*retval = result;
-		return;
+		ea->v = NULL;
+		execargs_cleanup(ea);
+		return result;
 	}
 
+	return 0;
+}
+
+// Load a staged image into a fresh address space for curproc and
+// enter it. Consumes EA either way; returns only on error.
+static int execargs_load(struct execargs *ea){
+	vaddr_t entrypoint, user_stack, user_buf;
+	vaddr_t *slots;
+	userptr_t user_env = NULL;
+	struct addrspace *as;
+	size_t nslots;
+	int argc = ea->argc;
+	int result;
+
 	struct addrspace *old = proc_getas();
 
 	//create new address space
 	as = as_create();
 	if(as == NULL){
-		vfs_close(v);
-		kfree(kargv);
-		kfree(prog);
-		kfree(kbuf_block_sizes);
-		*retval = ENOMEM;
-		return;
+		execargs_cleanup(ea);
+		return ENOMEM;
 	}
 
-	if (old != NULL) {as_destroy(old);}
+	// A vfork child's old address space is its parent's; leave it be
+	if (old != NULL && curproc->p_vfork == NULL) {as_destroy(old);}
 
 	//set new address space & activate
 	proc_setas(as);
 	as_activate();
 
+	// Off the parent's address space now, so it can run again
+	vfork_release(curproc);
+
 	//load elf exec
-	result = load_elf(v, &entrypoint);
+	result = load_elf(ea->v, &entrypoint);
 	if(result){
-		vfs_close(v);
-		kfree(kargv);
-		kfree(prog);
-		kfree(kbuf_block_sizes);
-		*retval = result;
-		return;
+		execargs_cleanup(ea);
+		return result;
 	}
 
 	//close program file now
-	vfs_close(v);
+	vfs_close(ea->v);
+	ea->v = NULL;
 
 	//get user stack pointer
 	result = as_define_stack(as, &user_stack);
 	if(result){
-		kfree(kargv);
-		kfree(prog);
-		kfree(kbuf_block_sizes);
-		*retval = result;
-		return;
+		execargs_cleanup(ea);
+		return result;
 	}
 
-	vaddr_t user_buf;
-	kargv[j] = NULL;
-	j = 0;
+	//the image sits at the top of the stack, 8-aligned for the ABI
+	user_buf = (user_stack - ea->len) & ~(vaddr_t)7;
 
-	//stack grows down, so we minus kernel buf size from top of stack to get user buffer pointer
-	user_buf = user_stack - total_buf_size;
-
-	//setting pointers on user stack before we copy out
-	while(j < l){
-		if(j == 0){
-		kargv[j] = (char*)((size_t)user_buf + kbuf_block_sizes[j]);
-		} else {
-		kargv[j] = (char*)((size_t)kargv[j-1] + kbuf_block_sizes[j]);
-		}
-		j++;
+	//turn the string offsets into user addresses; the NULLs stay NULL
+	nslots = ea->argc + 1;
+	if (ea->envoff > 0) {
+		nslots += ea->envc + 1;
+		user_env = (userptr_t)(user_buf + ea->envoff);
+	}
+	slots = (vaddr_t *)ea->image;
+	for (size_t i = 0; i < nslots; i++) {
+		if (slots[i] != 0) {slots[i] += user_buf;}
 	}
 
-
-	//copyout kernel buffer into user stack all in one chunk
-	result = copyout((const void*)&kargv[0], (userptr_t)user_buf, (total_buf_size));
+	//copyout the whole image into the user stack in one chunk
+	result = copyout(ea->image, (userptr_t)user_buf, ea->len);
 	if(result){
-		kfree(kargv);
-		kfree(prog);
-		kfree(kbuf_block_sizes);
-		*retval = result;
-		return;
+		execargs_cleanup(ea);
+		return result;
 	}
 
 	//free heap mem
-	kfree(kargv);
-	kfree(prog);
-	kfree(kbuf_block_sizes);
-	//set user stack pointer
-	user_stack = user_buf;
+	execargs_cleanup(ea);
 
 	//enter process
-	enter_new_process(j, (userptr_t)user_buf, NULL, user_stack, entrypoint);
+	enter_new_process(argc, (userptr_t)user_buf, user_env, user_buf, entrypoint);
 
 	panic("enter_new_proc returned\n");
-	return;
+	return EINVAL;
+}
+
+void sys_execv(const char *uprogram, char **uargs, char **uenv, int *retval){
+	struct execargs ea;
+
+	*retval = execargs_copyin(uprogram, uargs, uenv, &ea);
+	if (*retval) {return;}
+
+	*retval = execargs_load(&ea);
+}
+
+// Child side of spawn: the parent already staged the image and set up
+// our fd table, so all that's left is loading it. We have no user
+// context to return an error to, so a bad image exits with 127.
+static void enter_spawn(void *arg_ptr, unsigned long int nargs){
+	struct execargs *ea = arg_ptr;
+	struct execargs local;
+
+	(void)nargs;
+
+	local = *ea;
+	kfree(ea);
 
+	execargs_load(&local);
+	sys__exit(_MKWAIT_EXIT(127));
+}
+
+int sys_spawn(const char *uprogram, char **uargs, const int *ufds, int nfds, pid_t *retval){
+	struct execargs *ea;
+	struct proc *child;
+	int *fdmap = NULL;
+	int result;
+
+	*retval = 0;
+	if (nfds < 0 || nfds > __OPEN_MAX) {return EINVAL;}
+	if (nfds > 0) {
+		fdmap = kmalloc(nfds * sizeof(int));
+		if (fdmap == NULL) {return ENOMEM;}
+		result = copyin((const_userptr_t)ufds, fdmap, nfds * sizeof(int));
+		if (result) {
+			kfree(fdmap);
+			return result;
+		}
+	}
+
+	ea = kmalloc(sizeof(struct execargs));
+	if (ea == NULL) {
+		kfree(fdmap);
+		return ENOMEM;
+	}
+
+	// Everything that can fail on the caller's behalf happens here,
+	// before there is a child to clean up
+	result = execargs_copyin(uprogram, uargs, NULL, ea);
+	if (result) {
+		kfree(ea);
+		kfree(fdmap);
+		return result;
+	}
+
+	child = proc_fork(ea->prog);
+	if (child == NULL) {
+		execargs_cleanup(ea);
+		kfree(ea);
+		kfree(fdmap);
+		return EMPROC;
+	}
+
+	proc_addchild(curproc, child);
+
+	result = proc_inherit(child, fdmap, nfds);
+	kfree(fdmap);
+	if (result) {
+		execargs_cleanup(ea);
+		kfree(ea);
+		proc_unfork(child);
+		return result;
+	}
+
+	// No address space to copy: the child starts with none and
+	// loads the program into a fresh one
+	result = thread_fork(child->p_name, child, enter_spawn, ea, 0);
+	if (result) {
+		execargs_cleanup(ea);
+		kfree(ea);
+		proc_unfork(child);
+		return result;
+	}
+
+	*retval = child->pid;
+	return 0;
 }
 
 void *sys_sbrk(intptr_t amount,  int* retval){
@@ -498,13 +698,77 @@ void *sys_sbrk(intptr_t amount,  int* retval){
 
 }
 
-int get_size (char * s) {
-    char * t;
-    int size = 0;
+// Find the process an affinity call refers to: 0 (or our own pid) means
+// us, otherwise it must be one of our running children. Only we can
+// reap our children, so the proc stays valid after we return.
+static int affinity_target(pid_t pid, struct proc **ret){
+	struct pid_entry *pe;
+	bool running;
+	int result;
+
+	if (pid == 0 || pid == curproc->pid) {
+		*ret = curproc;
+		return 0;
+	}
+
+	result = pid_getchild(pid, curproc, &pe);
+	if (result) {return result == ECHILD ? EPERM : result;}
+
+	lock_acquire(pe->pid_lock);
+	running = (pid_status[pid] == RUNNING);
+	lock_release(pe->pid_lock);
+	if (!running) {return ESRCH;}
+
+	*ret = pe->proc;
+	return 0;
+}
+
+int sys_setaffinity(pid_t pid, unsigned mask){
+	struct proc *p;
+	struct thread *t;
+	bool self = false;
+	int result;
+
+	if ((mask & thread_cpumask()) == 0) {return EINVAL;}
+
+	result = affinity_target(pid, &p);
+	if (result) {return result;}
+
+	// Other threads just get the new mask; they move the next time
+	// they are scheduled
+	spinlock_acquire(&p->p_lock);
+	for (unsigned i = 0; i < threadarray_num(&p->p_threads); i++) {
+		t = threadarray_get(&p->p_threads, i);
+		if (t == curthread) {
+			self = true;
+			continue;
+		}
+		thread_setaffinity(t, mask);
+	}
+	spinlock_release(&p->p_lock);
+
+	// We may have to move, so do this without holding anything
+	if (self) {
+		result = thread_setaffinity(curthread, mask);
+	}
+	return result;
+}
+
+int sys_getaffinity(pid_t pid, unsigned *mask){
+	struct proc *p;
+	unsigned kmask = 0;
+	int result;
+
+	if (mask == NULL) {return EFAULT;}
+
+	result = affinity_target(pid, &p);
+	if (result) {return result;}
 
-    for (t = s; *t != '\0'; t++) {
-        size++;
-    }
+	spinlock_acquire(&p->p_lock);
+	if (threadarray_num(&p->p_threads) > 0) {
+		kmask = thread_getaffinity(threadarray_get(&p->p_threads, 0));
+	}
+	spinlock_release(&p->p_lock);
 
-    return size;
+	return copyout(&kmask, (userptr_t)mask, sizeof(kmask));
 }
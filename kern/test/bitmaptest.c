@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <test.h>
@@ -101,6 +102,20 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* bitmap_alloc_from: next clear bit at or after START, wrapping */
+	bitmap_unmark(b, 7);
+	bitmap_unmark(b, 300);
+	KASSERT(bitmap_alloc_from(b, 8, &x)==0 && x==300);
+	KASSERT(bitmap_alloc_from(b, 301, &x)==0 && x==7);
+	KASSERT(bitmap_alloc_from(b, 0, &x)==ENOSPC);
+
+	/* ...and across runs of full words, at either end of a word */
+	bitmap_unmark(b, 0);
+	bitmap_unmark(b, 519);
+	KASSERT(bitmap_alloc_from(b, 1, &x)==0 && x==519);
+	KASSERT(bitmap_alloc(b, &x)==0 && x==0);
+	KASSERT(bitmap_alloc(b, &x)==ENOSPC);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
@@ -34,6 +34,7 @@
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -271,12 +272,12 @@ cvtest(int nargs, char **args)
 {
 
 	int i, result;
-
-	(void)nargs;
-	(void)args;
+	bool morph;
 
 	inititems();
-	kprintf("Starting CV test...\n");
+	morph = nargs > 1 && !strcmp(args[1], "morph");
+	cv_setmorph(testcv, morph);
+	kprintf("Starting CV test%s...\n", morph ? " (wait-morphing)" : "");
 	kprintf("Threads should print out in reverse order.\n");
 
 	testval1 = NTHREADS-1;
@@ -399,3 +400,149 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock stress test.
+ *
+ * Every fourth thread is a writer; the rest are readers. Writers
+ * update the testvals under the write lock and check that nobody
+ * else is inside; readers check the testvals are consistent and
+ * that no writer is inside. We also track how many readers were
+ * inside at once, which should get above 1 if readers really do
+ * share the lock.
+ */
+
+#define NRWLOOPS 200
+
+static struct rwlock *testrw;
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rw_nreaders;
+static volatile unsigned rw_nwriters;
+static volatile unsigned rw_maxreaders;
+static volatile bool rw_failed;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	rw_failed = true;
+}
+
+static
+void
+rwtestreader(unsigned long num)
+{
+	volatile int j;
+
+	rwlock_acquire_read(testrw);
+
+	spinlock_acquire(&rwcount_lock);
+	rw_nreaders++;
+	if (rw_nreaders > rw_maxreaders) {
+		rw_maxreaders = rw_nreaders;
+	}
+	if (rw_nwriters != 0) {
+		rwfail(num, "reader inside with a writer");
+	}
+	spinlock_release(&rwcount_lock);
+
+	if (testval2 != testval1*testval1 || testval3 != testval1%3) {
+		rwfail(num, "reader saw inconsistent testvals");
+	}
+
+	/* linger a little so other readers get a chance to overlap */
+	for (j=0; j<500; j++);
+
+	spinlock_acquire(&rwcount_lock);
+	rw_nreaders--;
+	spinlock_release(&rwcount_lock);
+
+	rwlock_release_read(testrw);
+}
+
+static
+void
+rwtestwriter(unsigned long num)
+{
+	rwlock_acquire_write(testrw);
+	if (!rwlock_do_i_write(testrw)) {
+		rwfail(num, "rwlock_do_i_write is false for the writer");
+	}
+
+	spinlock_acquire(&rwcount_lock);
+	if (rw_nreaders != 0 || rw_nwriters != 0) {
+		rwfail(num, "writer did not get the lock exclusively");
+	}
+	rw_nwriters++;
+	spinlock_release(&rwcount_lock);
+
+	testval1 = num;
+	thread_yield();
+	testval2 = num*num;
+	testval3 = num%3;
+
+	spinlock_acquire(&rwcount_lock);
+	rw_nwriters--;
+	spinlock_release(&rwcount_lock);
+
+	rwlock_release_write(testrw);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % 4 == 0) {
+			rwtestwriter(num);
+		}
+		else {
+			rwtestreader(num);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	testval1 = testval2 = testval3 = 0;
+	rw_nreaders = rw_nwriters = rw_maxreaders = 0;
+	rw_failed = false;
+
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrw);
+	testrw = NULL;
+
+	kprintf("Most readers inside at once: %u\n", rw_maxreaders);
+	kprintf("Rwlock test %s.\n", rw_failed ? "FAILED" : "done");
+	return 0;
+}
@@ -34,6 +34,7 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <poll.h>
 
 /*
  * Time handling.
@@ -97,6 +98,7 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	poll_hardclock();
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
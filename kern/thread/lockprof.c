@@ -0,0 +1,181 @@
+/*
+ * Lock contention profiler. See lockprof.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <lockprof.h>
+
+/* Number of distinct (kind, name) pairs we track. */
+#define LOCKPROF_MAX		128
+
+/* Names are truncated to this many characters. */
+#define LOCKPROF_NAMELEN	24
+
+struct lockprof {
+	char lp_name[LOCKPROF_NAMELEN];
+	int lp_kind;
+	uint64_t lp_acquires;		/* times acquired (CV: waits) */
+	uint64_t lp_contended;		/* times we had to wait */
+	uint64_t lp_waitcycles;		/* total cycles spent waiting */
+	uint32_t lp_maxhold;		/* longest single hold, in cycles */
+};
+
+/*
+ * The table. Slot 0 is the overflow record for when the table fills.
+ *
+ * This is protected by a bare spinlock word rather than a struct
+ * spinlock, because spinlock_acquire itself calls in here.
+ */
+static struct lockprof lockprof_table[LOCKPROF_MAX];
+static unsigned lockprof_count;
+static volatile spinlock_data_t lockprof_busy = SPINLOCK_DATA_INITIALIZER;
+
+static const char *const lockprof_kindnames[] = {
+	"lock", "spin", "cv",
+};
+
+static
+int
+lockprof_enter(void)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(&lockprof_busy) != 0 ||
+	       spinlock_data_testandset(&lockprof_busy) != 0) {
+		/* spin */
+	}
+	return spl;
+}
+
+static
+void
+lockprof_leave(int spl)
+{
+	spinlock_data_set(&lockprof_busy, 0);
+	splx(spl);
+}
+
+struct lockprof *
+lockprof_get(const char *name, int kind)
+{
+	char key[LOCKPROF_NAMELEN];
+	struct lockprof *lp;
+	unsigned i;
+	int spl;
+
+	KASSERT(kind >= 0 && kind <= LOCKPROF_CV);
+	if (name == NULL) {
+		name = "(unnamed)";
+	}
+
+	/* Truncate the name the same way the table does. */
+	for (i=0; i<LOCKPROF_NAMELEN - 1 && name[i] != 0; i++) {
+		key[i] = name[i];
+	}
+	key[i] = 0;
+
+	spl = lockprof_enter();
+	if (lockprof_count == 0) {
+		strcpy(lockprof_table[0].lp_name, "(overflow)");
+		lockprof_count = 1;
+	}
+	for (i=1; i<lockprof_count; i++) {
+		lp = &lockprof_table[i];
+		if (lp->lp_kind == kind && !strcmp(lp->lp_name, key)) {
+			lockprof_leave(spl);
+			return lp;
+		}
+	}
+	if (lockprof_count == LOCKPROF_MAX) {
+		lockprof_leave(spl);
+		return &lockprof_table[0];
+	}
+	lp = &lockprof_table[lockprof_count++];
+	strcpy(lp->lp_name, key);
+	lp->lp_kind = kind;
+	lockprof_leave(spl);
+	return lp;
+}
+
+void
+lockprof_acquired(struct lockprof *lp, bool contended, uint32_t waited)
+{
+	int spl;
+
+	spl = lockprof_enter();
+	lp->lp_acquires++;
+	if (contended) {
+		lp->lp_contended++;
+		lp->lp_waitcycles += waited;
+	}
+	lockprof_leave(spl);
+}
+
+void
+lockprof_released(struct lockprof *lp, uint32_t held)
+{
+	int spl;
+
+	spl = lockprof_enter();
+	if (held > lp->lp_maxhold) {
+		lp->lp_maxhold = held;
+	}
+	lockprof_leave(spl);
+}
+
+void
+lockprof_report(void)
+{
+	struct lockprof *snap, tmp;
+	unsigned n, i, j;
+	int spl;
+
+	snap = kmalloc(LOCKPROF_MAX * sizeof(*snap));
+	if (snap == NULL) {
+		kprintf("lockprof: out of memory\n");
+		return;
+	}
+
+	/* Copy out and reset in one go, so no counts are lost. */
+	spl = lockprof_enter();
+	n = lockprof_count;
+	for (i=0; i<n; i++) {
+		snap[i] = lockprof_table[i];
+		lockprof_table[i].lp_acquires = 0;
+		lockprof_table[i].lp_contended = 0;
+		lockprof_table[i].lp_waitcycles = 0;
+		lockprof_table[i].lp_maxhold = 0;
+	}
+	lockprof_leave(spl);
+
+	/* Insertion sort, most total wait first. */
+	for (i=1; i<n; i++) {
+		tmp = snap[i];
+		for (j=i; j>0 && snap[j-1].lp_waitcycles < tmp.lp_waitcycles;
+		     j--) {
+			snap[j] = snap[j-1];
+		}
+		snap[j] = tmp;
+	}
+
+	kprintf("%-24s %-4s %10s %10s %14s %10s\n", "name", "kind",
+		"acquires", "contended", "wait cycles", "max hold");
+	for (i=0; i<n; i++) {
+		if (snap[i].lp_acquires == 0) {
+			continue;
+		}
+		kprintf("%-24s %-4s %10llu %10llu %14llu %10u\n",
+			snap[i].lp_name, lockprof_kindnames[snap[i].lp_kind],
+			(unsigned long long)snap[i].lp_acquires,
+			(unsigned long long)snap[i].lp_contended,
+			(unsigned long long)snap[i].lp_waitcycles,
+			snap[i].lp_maxhold);
+	}
+	kprintf("(counters reset)\n");
+
+	kfree(snap);
+}
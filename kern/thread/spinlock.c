@@ -38,11 +38,15 @@
 #include <spinlock.h>
 #include <membar.h>
 #include <current.h>	/* for curcpu */
+#include <lockprof.h>
 
 /*
  * Spinlocks.
  */
 
+/* Iterations of backoff per waiter ahead of us in line. */
+#define SPINLOCK_BACKOFF	16
+
 
 /*
  * Initialize spinlock.
@@ -50,8 +54,14 @@
 void
 spinlock_init(struct spinlock *splk)
 {
-	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	spinlock_data_set(&splk->splk_owner, 0);
 	splk->splk_holder = NULL;
+#if OPT_LOCKPROF
+	splk->splk_name = NULL;
+	splk->splk_prof = NULL;
+	splk->splk_acqtime = 0;
+#endif
 }
 
 /*
@@ -61,7 +71,8 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	KASSERT(spinlock_data_get(&splk->splk_next) ==
+		spinlock_data_get(&splk->splk_owner));
 }
 
 /*
@@ -69,12 +80,20 @@ spinlock_cleanup(struct spinlock *splk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket and wait for our turn.
  */
 void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket, serving;
+	volatile unsigned i;
+#if OPT_LOCKPROF
+	uint32_t start;
+	bool contended = false;
+
+	start = cpu_getcycles();
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -90,28 +109,43 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
+	/*
+	 * Ticket lock. Take the next ticket with an atomic
+	 * fetch-and-increment, then wait until splk_owner (the
+	 * ticket being served) comes round to ours. CPUs get the
+	 * lock in the order they asked for it, and only the atomic
+	 * increment writes to the lock; waiters just read.
+	 *
+	 * Back off in proportion to our distance from the front of
+	 * the line, so CPUs far back poll the owner word less often
+	 * than the one that is about to get the lock.
+	 */
+	ticket = spinlock_data_fetchinc(&splk->splk_next);
 	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
+		serving = spinlock_data_get(&splk->splk_owner);
+		if (serving == ticket) {
+			break;
 		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
+#if OPT_LOCKPROF
+		contended = true;
+#endif
+		for (i = (ticket - serving) * SPINLOCK_BACKOFF; i > 0; i--) {
+			/* nothing */
 		}
-		break;
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+
+#if OPT_LOCKPROF
+	if (splk->splk_prof == NULL) {
+		splk->splk_prof = lockprof_get(splk->splk_name,
+					       LOCKPROF_SPINLOCK);
+	}
+	splk->splk_acqtime = cpu_getcycles();
+	lockprof_acquired(splk->splk_prof, contended,
+			  splk->splk_acqtime - start);
+#endif
 }
 
 /*
@@ -127,9 +161,16 @@ spinlock_release(struct spinlock *splk)
 		curcpu->c_spinlocks--;
 	}
 
+#if OPT_LOCKPROF
+	lockprof_released(splk->splk_prof,
+			  cpu_getcycles() - splk->splk_acqtime);
+#endif
+
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	/* Only the holder writes splk_owner, so no atomic op is needed. */
+	spinlock_data_set(&splk->splk_owner,
+			  spinlock_data_get(&splk->splk_owner) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -146,3 +187,18 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+/*
+ * Name the lock for the lock profiler.
+ */
+void
+spinlock_setname(struct spinlock *splk, const char *name)
+{
+#if OPT_LOCKPROF
+	splk->splk_name = name;
+	splk->splk_prof = NULL;
+#else
+	(void)splk;
+	(void)name;
+#endif
+}
@@ -37,8 +37,10 @@
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <synch.h>
+#include <lockprof.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -157,6 +159,7 @@ lock_create(const char *name)
         // add stuff here as needed
 		lock->held = 0;
 		lock->holder = NULL;
+		lock->lock_sleepers = 0;
 		
 		//init'ing wait channel
 		lock->lock_wchan = wchan_create(lock->lk_name);
@@ -172,6 +175,11 @@ lock_create(const char *name)
 		//spinlock init
 		spinlock_init(&lock->lock_splk);
 
+#if OPT_LOCKPROF
+		lock->lk_prof = lockprof_get(lock->lk_name, LOCKPROF_SLEEPLOCK);
+		lock->lk_acqtime = 0;
+#endif
+
         return lock;
 }
 
@@ -192,34 +200,97 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Adaptive locking.
+ *
+ * Most of the kernel's locks (fd_lock, pid_lock, coremap_lock, ...)
+ * protect critical sections that are only a few dozen instructions
+ * long. If the holder is running on another CPU it will almost
+ * certainly let go before we could finish a context switch, so
+ * instead of going straight to sleep we spin for a while, as long as
+ * the holder stays on-CPU. If the holder is asleep, or on our own
+ * CPU, or we have spun for too long, we fall back to the wchan.
+ *
+ * The spin itself only reads the lock word; lock_splk is dropped
+ * while spinning so the holder can get in to release.
+ */
+
+/* Number of polls of the lock word between rechecks of the holder. */
+#define LOCK_SPIN_BATCH		64
+
+/* Maximum number of spin batches before giving up and sleeping. */
+#define LOCK_SPIN_MAXBATCHES	32
+
+/*
+ * Return true if the holder of LOCK is currently running on some
+ * other cpu. Must be called with lock_splk held, which guarantees
+ * the holder cannot release the lock (and thus cannot exit and have
+ * its thread structure freed) while we look at it.
+ */
+static
+bool
+lock_holder_oncpu(struct lock *lock)
+{
+	struct thread *holder;
+
+	KASSERT(spinlock_do_i_hold(&lock->lock_splk));
+
+	holder = lock->holder;
+	KASSERT(holder != NULL);
+	return holder->t_state == S_RUN && holder->t_cpu != curcpu->c_self;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
-		
-		KASSERT(lock != NULL);
-		//KASSERT(curthread->t_in_interrupt == false);
-		KASSERT(!lock_do_i_hold(lock));
+	unsigned batches, i;
+#if OPT_LOCKPROF
+	uint32_t start;
+	bool contended;
+#endif
 
-		//spinlock for wait channel
-		spinlock_acquire(&lock->lock_splk);
-		
-		while(lock->held == 1)
-		{
-			wchan_sleep(lock->lock_wchan, &lock->lock_splk);
+	KASSERT(lock != NULL);
+	KASSERT(!lock_do_i_hold(lock));
+
+	batches = 0;
+	spinlock_acquire(&lock->lock_splk);
+#if OPT_LOCKPROF
+	start = cpu_getcycles();
+	contended = lock->held == 1;
+#endif
+	while (lock->held == 1) {
+		if (batches < LOCK_SPIN_MAXBATCHES && lock_holder_oncpu(lock)) {
+			/*
+			 * Holder is running elsewhere; spin on the lock
+			 * word without the spinlock and look again.
+			 */
+			spinlock_release(&lock->lock_splk);
+			for (i = 0; i < LOCK_SPIN_BATCH && lock->held == 1; i++) {
+				/* nothing */
+			}
+			batches++;
+			spinlock_acquire(&lock->lock_splk);
+			continue;
 		}
-		
-		//double check that lock is free
-		KASSERT(lock->held == 0);
 
-		//acquire lock
-		lock->held = 1;
-		lock->holder = curthread;
+		/* lock_release takes us back off the count */
+		lock->lock_sleepers++;
+		wchan_sleep(lock->lock_wchan, &lock->lock_splk);
 
-		spinlock_release(&lock->lock_splk);
+		/* we were asleep; give spinning another full chance */
+		batches = 0;
+	}
 
-        // Write this
+	KASSERT(lock->held == 0);
+	lock->held = 1;
+	lock->holder = curthread;
 
-       // (void)lock;  // suppress warning until code gets written
+#if OPT_LOCKPROF
+	lock->lk_acqtime = cpu_getcycles();
+	lockprof_acquired(lock->lk_prof, contended, lock->lk_acqtime - start);
+#endif
+
+	spinlock_release(&lock->lock_splk);
 }
 
 void
@@ -227,23 +298,28 @@ lock_release(struct lock *lock)
 {
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));
-	
-	//get spinlock for wc
-	spinlock_acquire(&lock->lock_splk);
- 		
-		//release lock
-         lock->held = 0;
-		 lock->holder = NULL;
-         KASSERT(lock->held == 0);
 
-	//wake next thread on wait channel queue
-     wchan_wakeone(lock->lock_wchan, &lock->lock_splk);
+	spinlock_acquire(&lock->lock_splk);
 
-	
-     spinlock_release(&lock->lock_splk);
-        // Write this
+#if OPT_LOCKPROF
+	lockprof_released(lock->lk_prof, cpu_getcycles() - lock->lk_acqtime);
+#endif
+
+	lock->held = 0;
+	lock->holder = NULL;
+
+	/*
+	 * Fast path: if nobody is asleep on the lock, anyone still
+	 * interested is spinning and will see held go to 0 by itself,
+	 * so skip the wchan (and the runqueue lock it would take).
+	 * Sleepers include CV waiters morphed onto our wchan.
+	 */
+	if (lock->lock_sleepers > 0) {
+		lock->lock_sleepers--;
+		wchan_wakeone(lock->lock_wchan, &lock->lock_splk);
+	}
 
-       // (void)lock;  // suppress warning until code gets written
+	spinlock_release(&lock->lock_splk);
 }
 
 bool
@@ -286,15 +362,19 @@ cv_create(const char *name)
 	
 		//init wait channel
 		cv->cv_wchan = wchan_create(cv->cv_name);
-		if(cv->cv_name == NULL){
+		if(cv->cv_wchan == NULL){
 			kfree(cv->cv_name);
 			kfree(cv);
 			return NULL;
 		}
 		
-		//init spinlocks for wc
-		spinlock_init(&cv->cv_splk); 
-		spinlock_init(&cv->cv_splk_2);
+		//init spinlock for wc
+		spinlock_init(&cv->cv_splk);
+		cv->cv_morph = false;
+
+#if OPT_LOCKPROF
+		cv->cv_prof = lockprof_get(cv->cv_name, LOCKPROF_CV);
+#endif
 
         // add stuff here as needed
 
@@ -309,7 +389,6 @@ cv_destroy(struct cv *cv)
         //destroying objs and freeing cv
 		wchan_destroy(cv->cv_wchan);
 	   spinlock_cleanup(&cv->cv_splk);
-	   spinlock_cleanup(&cv->cv_splk_2);
 		kfree(cv->cv_name);
         // add stuff here as needed
 
@@ -319,9 +398,17 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
+#if OPT_LOCKPROF
+	uint32_t start, slept;
+#endif
+
 	KASSERT(cv != NULL);	
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));
+
+#if OPT_LOCKPROF
+	start = cpu_getcycles();
+#endif
 	
 	//hold spinlock to enter wc
 	spinlock_acquire(&cv->cv_splk);
@@ -335,10 +422,49 @@ cv_wait(struct cv *cv, struct lock *lock)
 	//release spinlock & try to reacquire lock
 	spinlock_release(&cv->cv_splk);
 
+#if OPT_LOCKPROF
+	/* for a CV, the "hold" is the time spent asleep */
+	slept = cpu_getcycles() - start;
+	lockprof_acquired(cv->cv_prof, true, slept);
+	lockprof_released(cv->cv_prof, slept);
+#endif
+
 		lock_acquire(lock);
         // Write this
 }
 
+void
+cv_setmorph(struct cv *cv, bool morph)
+{
+	KASSERT(cv != NULL);
+
+	spinlock_acquire(&cv->cv_splk);
+	cv->cv_morph = morph;
+	spinlock_release(&cv->cv_splk);
+}
+
+/*
+ * Wait-morphing: move one or all waiters from the CV's wchan onto the
+ * lock's, without waking them. The caller holds LOCK, so every one
+ * of them will get woken by a lock_release, one at a time, and not
+ * before the lock is free. Takes cv_splk then lock_splk, the same
+ * order as cv_wait.
+ */
+static
+void
+cv_morph(struct cv *cv, struct lock *lock, bool all)
+{
+	unsigned n;
+
+	KASSERT(spinlock_do_i_hold(&cv->cv_splk));
+
+	spinlock_acquire(&lock->lock_splk);
+	n = wchan_move(cv->cv_wchan, &cv->cv_splk,
+		       lock->lock_wchan, &lock->lock_splk, all);
+	lock->lock_sleepers += n;
+	spinlock_release(&lock->lock_splk);
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -346,18 +472,17 @@ cv_signal(struct cv *cv, struct lock *lock)
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));	
 
-	//acquire spinlock
-	spinlock_acquire(&cv->cv_splk_2);
+	//acquire spinlock (same one cv_wait sleeps with)
+	spinlock_acquire(&cv->cv_splk);
 		
 		//signal to next thread on wc
-		wchan_wakeone(cv->cv_wchan, &cv->cv_splk_2);
+		if (cv->cv_morph) {
+			cv_morph(cv, lock, false);
+		} else {
+			wchan_wakeone(cv->cv_wchan, &cv->cv_splk);
+		}
 	
-	spinlock_release(&cv->cv_splk_2);
-
-
-        // Write this
-	//(void)cv;    // suppress warning until code gets written
-	//(void)lock;  // suppress warning until code gets written
+	spinlock_release(&cv->cv_splk);
 }
 
 void
@@ -368,13 +493,196 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	KASSERT(lock_do_i_hold(lock));
 	
 	//spinlock for wc
-	spinlock_acquire(&cv->cv_splk_2);
+	spinlock_acquire(&cv->cv_splk);
 		
 		//wake all threads on wc
-		wchan_wakeall(cv->cv_wchan, &cv->cv_splk_2);
+		if (cv->cv_morph) {
+			cv_morph(cv, lock, true);
+		} else {
+			wchan_wakeall(cv->cv_wchan, &cv->cv_splk);
+		}
+
+	spinlock_release(&cv->cv_splk);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(struct rwlock));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_rwchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_rwchan == NULL) {
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_wwchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_wwchan == NULL) {
+		wchan_destroy(rw->rw_rwchan);
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_splk);
+	rw->rw_readers = 0;
+	rw->rw_rwaiting = 0;
+	rw->rw_wwaiting = 0;
+	rw->rw_rgen = 0;
+	rw->rw_wgrant = 0;
+	rw->rw_writing = false;
+	rw->rw_writer = NULL;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writing == false);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&rw->rw_splk);
+	wchan_destroy(rw->rw_wwchan);
+	wchan_destroy(rw->rw_rwchan);
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+/*
+ * Hand the lock to one sleeping writer. The writer is marked as
+ * holding it before it runs, so nobody else can get in first.
+ */
+static
+void
+rwlock_grant_writer(struct rwlock *rw)
+{
+	KASSERT(spinlock_do_i_hold(&rw->rw_splk));
+	KASSERT(rw->rw_wwaiting > 0);
+
+	rw->rw_writing = true;
+	rw->rw_wwaiting--;
+	rw->rw_wgrant++;
+	wchan_wakeone(rw->rw_wwchan, &rw->rw_splk);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	unsigned gen;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_splk);
+	if (!rw->rw_writing && rw->rw_wwaiting == 0) {
+		rw->rw_readers++;
+		spinlock_release(&rw->rw_splk);
+		return;
+	}
+
+	/*
+	 * Wait for the next reader batch. Whoever lets the batch in
+	 * counts us in rw_readers for us.
+	 */
+	rw->rw_rwaiting++;
+	gen = rw->rw_rgen;
+	while (rw->rw_rgen == gen) {
+		wchan_sleep(rw->rw_rwchan, &rw->rw_splk);
+	}
+	KASSERT(rw->rw_readers > 0);
+	spinlock_release(&rw->rw_splk);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_splk);
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(!rw->rw_writing);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_wwaiting > 0) {
+		rwlock_grant_writer(rw);
+	}
+	spinlock_release(&rw->rw_splk);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_splk);
+	if (!rw->rw_writing && rw->rw_readers == 0) {
+		rw->rw_writing = true;
+	}
+	else {
+		rw->rw_wwaiting++;
+		while (rw->rw_wgrant == 0) {
+			wchan_sleep(rw->rw_wwchan, &rw->rw_splk);
+		}
+		rw->rw_wgrant--;
+	}
+	KASSERT(rw->rw_writing);
+	KASSERT(rw->rw_readers == 0);
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_splk);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rwlock_do_i_write(rw));
+
+	spinlock_acquire(&rw->rw_splk);
+	rw->rw_writer = NULL;
+	rw->rw_writing = false;
+
+	if (rw->rw_rwaiting > 0) {
+		/*
+		 * Readers that queued up behind us go next, even if
+		 * more writers are waiting; that's what keeps writer
+		 * preference from starving readers.
+		 */
+		rw->rw_readers += rw->rw_rwaiting;
+		rw->rw_rwaiting = 0;
+		rw->rw_rgen++;
+		wchan_wakeall(rw->rw_rwchan, &rw->rw_splk);
+	}
+	else if (rw->rw_wwaiting > 0) {
+		rwlock_grant_writer(rw);
+	}
+	spinlock_release(&rw->rw_splk);
+}
+
+bool
+rwlock_do_i_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
 
-	spinlock_release(&cv->cv_splk_2);
-	// Write this
-//	(void)cv;    // suppress warning until code gets written
-//	(void)lock;  // suppress warning until code gets written
+	return rw->rw_writer == curthread;
 }
@@ -78,6 +78,14 @@ static struct wchanarray allwchans;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+static void thread_switch(threadstate_t newstate, struct wchan *wc,
+			  struct spinlock *lk);
+static int thread_fork_affinity(const char *name, struct proc *proc,
+				uint32_t affinity,
+				void (*entrypoint)(void *, unsigned long),
+				void *data1, unsigned long data2);
+static void thread_idle(void *junk, unsigned long num);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -117,6 +125,34 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Set up the fields of a thread. THREAD is either fresh from kmalloc
+ * or a recycled one from the thread cache; t_name and t_stack are
+ * handled by the caller.
+ */
+static
+void
+thread_setup(struct thread *thread)
+{
+	thread->t_wchan_name = "NEW";
+	thread->t_state = S_READY;
+
+	/* Thread subsystem fields */
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_context = NULL;
+	thread->t_cpu = NULL;
+	thread->t_proc = NULL;
+	thread->t_affinity = THREAD_AFFINITY_ALL;
+
+	/* Interrupt state fields */
+	thread->t_in_interrupt = false;
+	thread->t_curspl = IPL_HIGH;
+	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+
+	/* If you add to struct thread, be sure to initialize here */
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -139,23 +175,8 @@ thread_create(const char *name)
 		kfree(thread);
 		return NULL;
 	}
-	thread->t_wchan_name = "NEW";
-	thread->t_state = S_READY;
-
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
 	thread->t_stack = NULL;
-	thread->t_context = NULL;
-	thread->t_cpu = NULL;
-	thread->t_proc = NULL;
-
-	/* Interrupt state fields */
-	thread->t_in_interrupt = false;
-	thread->t_curspl = IPL_HIGH;
-	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
-
-	/* If you add to struct thread, be sure to initialize here */
+	thread_setup(thread);
 
 	return thread;
 }
@@ -185,16 +206,21 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
+	c->c_idlethread = NULL;
+	c->c_migrating = NULL;
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	spinlock_setname(&c->c_runqueue_lock, "runqueue");
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
+	spinlock_setname(&c->c_ipi_lock, "ipi");
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
@@ -269,9 +295,86 @@ thread_destroy(struct thread *thread)
 	kfree(thread);
 }
 
+/*
+ * Thread cache.
+ *
+ * Rather than freeing every exited thread and allocating a new
+ * struct thread and a new STACK_SIZE stack on every thread_fork, each
+ * cpu keeps a few dead threads, stack and all, ready for reuse.
+ *
+ * The cache is per-cpu and only touched by its own cpu with
+ * interrupts off, so it needs no lock.
+ */
+
+/* Maximum number of threads cached per cpu. */
+#define THREAD_CACHE_MAX 8
+
+/*
+ * Try to put a zombie in the current cpu's cache. Returns false if it
+ * can't be cached (no stack, or the cache is full), in which case the
+ * caller should destroy it.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(thread->t_state == S_ZOMBIE);
+	KASSERT(thread->t_proc == NULL);
+
+	if (thread->t_stack == NULL ||
+	    curcpu->c_threadcache.tl_count >= THREAD_CACHE_MAX) {
+		return false;
+	}
+
+	thread_machdep_cleanup(&thread->t_machdep);
+	kfree(thread->t_name);
+	thread->t_name = NULL;
+	thread->t_wchan_name = "CACHED";
+	threadlist_addtail(&curcpu->c_threadcache, thread);
+	return true;
+}
+
+/*
+ * Get a thread with a stack out of the current cpu's cache, named
+ * NAME and set up as by thread_create. Returns NULL if the cache is
+ * empty (or we can't copy the name).
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	thread->t_name = kstrdup(name);
+	if (thread->t_name == NULL) {
+		thread_destroy(thread);
+		return NULL;
+	}
+	thread_setup(thread);
+
+	/*
+	 * No need to refill the stack guard band: thread_exit checked
+	 * it was intact when this thread died, and nothing has used
+	 * the stack since.
+	 */
+	thread_checkstack(thread);
+
+	return thread;
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to have thread_destroy called on them.) Zombies with stacks
+ * are recycled into the thread cache while there's room.
  *
  * The list of zombies is per-cpu.
  */
@@ -284,7 +387,9 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (!thread_cache_put(z)) {
+			thread_destroy(z);
+		}
 	}
 }
 
@@ -440,6 +545,96 @@ thread_start_cpus(void)
 	}
 	sem_destroy(cpu_startup_sem);
 	cpu_startup_sem = NULL;
+
+	/*
+	 * Give each cpu an idle thread pinned to it, so a thread that
+	 * has to leave a cpu has something else to switch to.
+	 */
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		if (thread_fork_affinity("idle", NULL, THREAD_AFFINITY_CPU(i),
+					 thread_idle, NULL, i)) {
+			panic("thread_start_cpus: Cannot fork idle thread\n");
+		}
+	}
+}
+
+/*
+ * CPU affinity.
+ *
+ * Each thread carries a mask of the cpus it may run on. It is
+ * honoured when a new thread is placed (thread_fork), when ready
+ * threads are moved between cpus (thread_consider_migration), and
+ * when a running thread finds itself on a cpu outside its mask: the
+ * next time it yields, thread_switch sets it aside in c_migrating
+ * instead of putting it back on the run queue, and whichever thread
+ * runs next on that cpu (the cpu's idle thread, if there is nothing
+ * else) sends it on once we're off its stack.
+ */
+
+/* True if thread T may run on cpu C. */
+#define THREAD_CANRUN(t, c) \
+	(((t)->t_affinity & THREAD_AFFINITY_CPU((c)->c_number)) != 0)
+
+uint32_t
+thread_cpumask(void)
+{
+	unsigned numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus >= 32) {
+		return THREAD_AFFINITY_ALL;
+	}
+	return THREAD_AFFINITY_CPU(numcpus) - 1;
+}
+
+/*
+ * Choose a cpu in MASK to put a thread on: the current cpu if it's
+ * allowed, otherwise the allowed cpu with the shortest run queue.
+ * The run queue lengths are read without locking; it's only a hint.
+ */
+static
+struct cpu *
+thread_pickcpu(uint32_t mask)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
+
+	if (mask & THREAD_AFFINITY_CPU(curcpu->c_number)) {
+		return curcpu->c_self;
+	}
+
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((mask & THREAD_AFFINITY_CPU(c->c_number)) == 0) {
+			continue;
+		}
+		if (best == NULL ||
+		    c->c_runqueue.tl_count < best->c_runqueue.tl_count) {
+			best = c;
+		}
+	}
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Idle thread. Each cpu has one, which spends its life parked in
+ * c_idlethread; thread_switch only runs it when the thread being
+ * switched away from is leaving the cpu and there's nothing else to
+ * run, so that the cpu doesn't idle on the departing thread's stack.
+ */
+static
+void
+thread_idle(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (1) {
+		thread_switch(S_SLEEP, NULL, NULL);
+	}
 }
 
 /*
@@ -488,37 +683,45 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller. It may run on the cpus in
+ * AFFINITY, and will start on the same CPU as the caller if that's
+ * one of them, unless the scheduler intervenes first.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_affinity(const char *name,
+		     struct proc *proc,
+		     uint32_t affinity,
+		     void (*entrypoint)(void *data1, unsigned long data2),
+		     void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	/* Recycle a dead thread and its stack if we have one handy */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = affinity;
+	newthread->t_cpu = thread_pickcpu(affinity);
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -541,12 +744,50 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
+	/* Lock the chosen cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
 }
 
+/*
+ * Create a new thread with the same affinity as the caller.
+ */
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_affinity(name, proc, curthread->t_affinity,
+				    entrypoint, data1, data2);
+}
+
+/*
+ * Send on the thread that thread_switch set aside in c_migrating, if
+ * any. Called after the switch, from whatever thread now runs on this
+ * cpu, at which point the departing thread's context has been saved.
+ */
+static
+void
+thread_finish_migration(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_migrating;
+	if (t == NULL) {
+		return;
+	}
+	curcpu->c_migrating = NULL;
+
+	KASSERT(t != curthread);
+	KASSERT(t->t_state == S_READY);
+	t->t_cpu = thread_pickcpu(t->t_affinity);
+	DEBUG(DB_THREADS, "Migrated thread %s: cpu %u -> %u",
+	      t->t_name, curcpu->c_number, t->t_cpu->c_number);
+	thread_make_runnable(t, false);
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -588,7 +829,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    THREAD_CANRUN(cur, curcpu)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -599,9 +841,22 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		if (!THREAD_CANRUN(cur, curcpu)) {
+			/* Not allowed here; send it on after the switch */
+			KASSERT(curcpu->c_migrating == NULL);
+			curcpu->c_migrating = cur;
+			break;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		if (wc == NULL) {
+			/* Idle thread parking itself; see thread_idle */
+			KASSERT(curcpu->c_idlethread == NULL);
+			cur->t_wchan_name = "IDLE";
+			curcpu->c_idlethread = cur;
+			break;
+		}
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -642,6 +897,19 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	curcpu->c_isidle = true;
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
+		if (next == NULL && curcpu->c_migrating != NULL) {
+			/*
+			 * Don't idle on the stack of a thread that is
+			 * leaving; switch to the idle thread. If there
+			 * isn't one yet, the thread just stays here.
+			 */
+			next = curcpu->c_idlethread;
+			curcpu->c_idlethread = NULL;
+			if (next == NULL) {
+				next = curcpu->c_migrating;
+				curcpu->c_migrating = NULL;
+			}
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
 			cpu_idle();
@@ -723,6 +991,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on the previous thread if it's changing cpus. */
+	thread_finish_migration();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -756,6 +1027,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on the previous thread if it's changing cpus. */
+	thread_finish_migration();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -864,9 +1138,35 @@ thread_consider_migration(void)
 {
 	unsigned my_count, total_count, one_share, to_send;
 	unsigned i, numcpus;
+	uint32_t mybit;
 	struct cpu *c;
 	struct threadlist victims;
-	struct thread *t;
+	struct thread *t, *prev;
+
+	mybit = THREAD_AFFINITY_CPU(curcpu->c_number);
+	threadlist_init(&victims);
+
+	/*
+	 * First, evict any ready threads that aren't allowed here at
+	 * all (their affinity changed while they were queued) and send
+	 * each to a cpu it is allowed on. See below about curthread.
+	 */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (t = curcpu->c_runqueue.tl_tail.tln_prev->tln_self;
+	     t != NULL; t = prev) {
+		prev = t->t_listnode.tln_prev->tln_self;
+		if (t != curthread && !THREAD_CANRUN(t, curcpu)) {
+			threadlist_remove(&curcpu->c_runqueue, t);
+			threadlist_addtail(&victims, t);
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	while ((t = threadlist_remhead(&victims)) != NULL) {
+		t->t_cpu = thread_pickcpu(t->t_affinity);
+		DEBUG(DB_THREADS, "Evicted thread %s: cpu %u -> %u",
+		      t->t_name, curcpu->c_number, t->t_cpu->c_number);
+		thread_make_runnable(t, false);
+	}
 
 	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
@@ -882,17 +1182,26 @@ thread_consider_migration(void)
 
 	one_share = DIVROUNDUP(total_count, numcpus);
 	if (my_count < one_share) {
+		threadlist_cleanup(&victims);
 		return;
 	}
 
+	/*
+	 * Take candidates from the tail of the run queue, skipping
+	 * threads that aren't allowed on any other cpu.
+	 */
 	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	for (t = curcpu->c_runqueue.tl_tail.tln_prev->tln_self;
+	     t != NULL && victims.tl_count < to_send; t = prev) {
+		prev = t->t_listnode.tln_prev->tln_self;
+		if ((t->t_affinity & ~mybit) != 0) {
+			threadlist_remove(&curcpu->c_runqueue, t);
+			threadlist_addhead(&victims, t);
+		}
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
+	to_send = victims.tl_count;
 
 	for (i=0; i < numcpus && to_send > 0; i++) {
 		c = cpuarray_get(&allcpus, i);
@@ -901,8 +1210,9 @@ thread_consider_migration(void)
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
 		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
 			/*
+			 * Find a victim that's allowed to run on C.
+			 *
 			 * Ordinarily, curthread will not appear on
 			 * the run queue. However, it can under the
 			 * following circumstances:
@@ -919,16 +1229,18 @@ thread_consider_migration(void)
 			 * while things are in this state and see
 			 * curthread. However, *migrating* curthread
 			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
+			 * Why? And what?) so skip it. Then it goes
+			 * back on our own run queue below.
 			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
+			THREADLIST_FORALL(t, victims) {
+				if (t != curthread && THREAD_CANRUN(t, c)) {
+					break;
+				}
 			}
+			if (t == NULL) {
+				break;
+			}
+			threadlist_remove(&victims, t);
 
 			t->t_cpu = c;
 			threadlist_addtail(&c->c_runqueue, t);
@@ -949,8 +1261,9 @@ thread_consider_migration(void)
 
 	/*
 	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
+	 * changed while we were working, and some victims may not have
+	 * been allowed anywhere that had room. Don't panic; just put them
+	 * back on our own run queue.
 	 */
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
@@ -964,6 +1277,32 @@ thread_consider_migration(void)
 	threadlist_cleanup(&victims);
 }
 
+/*
+ * Affinity API; see thread.h.
+ */
+int
+thread_setaffinity(struct thread *t, uint32_t mask)
+{
+	if ((mask & thread_cpumask()) == 0) {
+		return EINVAL;
+	}
+
+	/* A word store; readers just see the old or the new mask */
+	t->t_affinity = mask;
+
+	if (t == curthread && !THREAD_CANRUN(t, curcpu)) {
+		/* thread_switch will send us somewhere we're allowed */
+		thread_yield();
+	}
+	return 0;
+}
+
+uint32_t
+thread_getaffinity(struct thread *t)
+{
+	return t->t_affinity & thread_cpumask();
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -1117,6 +1456,32 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move sleeping threads from one wait channel to another. They stay
+ * asleep; whoever wakes TO will wake them. Used for wait-morphing in
+ * CVs.
+ */
+unsigned
+wchan_move(struct wchan *from, struct spinlock *fromlk,
+	   struct wchan *to, struct spinlock *tolk, bool all)
+{
+	struct thread *target;
+	unsigned n;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	n = 0;
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		threadlist_addtail(&to->wc_threads, target);
+		n++;
+		if (!all) {
+			break;
+		}
+	}
+	return n;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -0,0 +1,999 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Block buffer cache. See buf.h.
+ *
+ * Every cached block is on a hash chain keyed by (device, block). A
+ * buffer nobody holds is also on one of the queues below, least
+ * recently released first; a buffer in use is on none, so it can't
+ * be picked for eviction.
+ *
+ * Disk I/O goes to the device as a struct bio (see device.h), so it can
+ * be started now and finished later. A buffer with I/O in flight is
+ * busy and held by the I/O. Synchronous I/O is waited for before the
+ * big lock is let go of, so nobody else sees it busy; read-ahead is
+ * asynchronous, and is finished off ("reaped") by whoever next comes
+ * looking, after the driver has put it on buffer_iodone from its
+ * interrupt handler. buffer_iolock, a spinlock, covers only the
+ * completion of I/O; everything else is under the big lock.
+ *
+ * Writes are delayed. Dirty buffers go back to disk in block order,
+ * adjacent blocks in one I/O: from the syncer thread every
+ * BUFFER_SYNC_INTERVAL seconds, when a writer takes the count of dirty
+ * buffers over BUFFER_DIRTY_HIGH (it then writes back until there are
+ * only BUFFER_DIRTY_LOW), and on eviction.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <clock.h>
+#include <vfs.h>
+#include <device.h>
+#include <buf.h>
+
+/* Queues */
+#define BQ_NONE		0	/* in use: on no queue */
+#define BQ_FREE		1	/* holds no block */
+#define BQ_PROBATION	2	/* used once (2Q's A1 queue) */
+#define BQ_LRU		3	/* used again since it was read (2Q's Am) */
+#define BQ_NUM		4
+
+/* Share of the cache the probationary queue may keep to itself */
+#define BUFFER_PROBATION_MAX	(BUFFER_MAX / 4)
+
+#define BUFFER_HASHSIZE		64
+
+/* Write-behind */
+#define BUFFER_DIRTY_HIGH	(BUFFER_MAX * 3 / 4)
+#define BUFFER_DIRTY_LOW	(BUFFER_MAX / 2)
+#define BUFFER_BATCH		16	/* most blocks in one write */
+#define BUFFER_SYNC_INTERVAL	5	/* seconds */
+
+/* Most read-ahead I/Os in flight; past this, new ones are dropped */
+#define BUFFER_RAMAX		32
+
+struct bufio;
+
+struct buf {
+	struct device *b_dev;		/* NULL if holding no block */
+	daddr_t b_block;
+	void *b_data;
+	unsigned b_refcount;		/* holders */
+	bool b_valid;			/* b_data holds the block */
+	bool b_dirty;			/* b_data is newer than the disk */
+	bool b_reused;			/* found in the cache since read */
+	bool b_prefetched;		/* read ahead, and not used yet */
+	bool b_busy;			/* I/O in flight */
+	struct bufio *b_io;		/* that I/O */
+	unsigned b_queue;		/* BQ_* */
+	struct buf *b_hashnext;
+	struct buf *b_prev;		/* on b_queue */
+	struct buf *b_next;
+};
+
+struct bufqueue {
+	struct buf *bq_head;		/* least recently released */
+	struct buf *bq_tail;
+	unsigned bq_num;
+};
+
+static struct buf *buffer_hash[BUFFER_HASHSIZE];
+static struct bufqueue buffer_queues[BQ_NUM];
+static unsigned buffer_total;
+static unsigned buffer_ndirty;
+
+/*
+ * One I/O: a run of buffers for consecutive blocks of one device.
+ */
+struct bufio {
+	struct bio bi_bio;
+	struct iovec bi_iov[BUFFER_BATCH];
+	struct buf *bi_bufs[BUFFER_BATCH];
+	unsigned bi_num;
+	bool bi_async;			/* nobody waiting; reap when done */
+	bool bi_done;			/* under buffer_iolock */
+	struct bufio *bi_next;		/* on buffer_iodone */
+};
+
+static struct spinlock buffer_iolock = SPINLOCK_INITIALIZER;
+static struct wchan *buffer_iowchan;
+static struct bufio *buffer_iodone;	/* async I/O done, not reaped yet */
+static unsigned buffer_nasync;		/* async I/O not reaped yet */
+static bool buffer_flushing;		/* in buffer_flush */
+
+////////////////////////////////////////////////////////////
+// Queues and hash chains
+
+static
+void
+bufqueue_remove(struct buf *b)
+{
+	struct bufqueue *bq;
+
+	if (b->b_queue == BQ_NONE) {
+		return;
+	}
+	bq = &buffer_queues[b->b_queue];
+
+	if (b->b_prev != NULL) {
+		b->b_prev->b_next = b->b_next;
+	}
+	else {
+		bq->bq_head = b->b_next;
+	}
+	if (b->b_next != NULL) {
+		b->b_next->b_prev = b->b_prev;
+	}
+	else {
+		bq->bq_tail = b->b_prev;
+	}
+	b->b_prev = b->b_next = NULL;
+	b->b_queue = BQ_NONE;
+	bq->bq_num--;
+}
+
+static
+void
+bufqueue_append(unsigned q, struct buf *b)
+{
+	struct bufqueue *bq = &buffer_queues[q];
+
+	KASSERT(b->b_queue == BQ_NONE);
+
+	b->b_prev = bq->bq_tail;
+	b->b_next = NULL;
+	if (bq->bq_tail != NULL) {
+		bq->bq_tail->b_next = b;
+	}
+	else {
+		bq->bq_head = b;
+	}
+	bq->bq_tail = b;
+	b->b_queue = q;
+	bq->bq_num++;
+}
+
+static
+struct buf **
+buffer_hashchain(struct device *dev, daddr_t block)
+{
+	unsigned h;
+
+	h = ((uintptr_t)dev / sizeof(void *)) * 31 + block;
+	return &buffer_hash[h % BUFFER_HASHSIZE];
+}
+
+static
+struct buf *
+buffer_lookup(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = *buffer_hashchain(dev, block); b != NULL; b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Make B hold BLOCK of DEV.
+ */
+static
+void
+buffer_assign(struct buf *b, struct device *dev, daddr_t block)
+{
+	struct buf **chain;
+
+	KASSERT(b->b_dev == NULL);
+
+	b->b_dev = dev;
+	b->b_block = block;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_reused = false;
+	b->b_prefetched = false;
+
+	chain = buffer_hashchain(dev, block);
+	b->b_hashnext = *chain;
+	*chain = b;
+}
+
+/*
+ * Make B hold nothing, throwing away its contents.
+ */
+static
+void
+buffer_forget(struct buf *b)
+{
+	struct buf **pp;
+
+	if (b->b_dev == NULL) {
+		return;
+	}
+
+	for (pp = buffer_hashchain(b->b_dev, b->b_block); *pp != b;
+	     pp = &(*pp)->b_hashnext) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = b->b_hashnext;
+	b->b_hashnext = NULL;
+
+	if (b->b_dirty) {
+		buffer_ndirty--;
+	}
+	b->b_dev = NULL;
+	b->b_valid = false;
+	b->b_dirty = false;
+}
+
+////////////////////////////////////////////////////////////
+// Disk I/O
+
+/*
+ * Completion callback for all our I/O; may be called from an
+ * interrupt handler.
+ */
+static
+void
+buffer_biodone(struct bio *bio)
+{
+	struct bufio *bi = bio->bio_data;
+
+	spinlock_acquire(&buffer_iolock);
+	bi->bi_done = true;
+	if (bi->bi_async) {
+		bi->bi_next = buffer_iodone;
+		buffer_iodone = bi;
+	}
+	wchan_wakeall(buffer_iowchan, &buffer_iolock);
+	spinlock_release(&buffer_iolock);
+}
+
+/*
+ * Hand an I/O to the device. One that can't queue requests does it
+ * now, through the ordinary I/O entry point.
+ */
+static
+void
+buffer_submit(struct bufio *bi)
+{
+	struct device *dev = bi->bi_bufs[0]->b_dev;
+	struct bio *bio = &bi->bi_bio;
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	for (i = 0; i < bi->bi_num; i++) {
+		bi->bi_iov[i].iov_kbase = bi->bi_bufs[i]->b_data;
+		bi->bi_iov[i].iov_len = BUFFER_SIZE;
+	}
+	bio->bio_iov = bi->bi_iov;
+	bio->bio_iovcnt = bi->bi_num;
+	bio->bio_block = bi->bi_bufs[0]->b_block;
+	bio->bio_done = buffer_biodone;
+	bio->bio_data = bi;
+
+	spinlock_acquire(&buffer_iolock);
+	bi->bi_done = false;
+	spinlock_release(&buffer_iolock);
+
+	if (dev->d_ops->devop_strategy != NULL) {
+		result = DEVOP_STRATEGY(dev, bio);
+		if (result) {
+			bio->bio_error = result;
+			buffer_biodone(bio);
+		}
+		return;
+	}
+
+	ku.uio_iov = bi->bi_iov;
+	ku.uio_iovcnt = bi->bi_num;
+	ku.uio_offset = (off_t)bio->bio_block * BUFFER_SIZE;
+	ku.uio_resid = bi->bi_num * BUFFER_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = bio->bio_rw;
+	ku.uio_space = NULL;
+
+	bio->bio_error = DEVOP_IO(dev, &ku);
+	buffer_biodone(bio);
+}
+
+/*
+ * Start reading or writing the blocks of N buffers in one I/O. The
+ * buffers are for consecutive blocks of one device. Each is held,
+ * and busy, until the I/O is finished.
+ */
+static
+int
+buffer_iostart(struct buf **bufs, unsigned n, enum uio_rw rw, bool async,
+	       struct bufio **ret)
+{
+	struct bufio *bi;
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(n > 0 && n <= BUFFER_BATCH);
+
+	DEBUG(DB_VFS, "buffer: %s %u+%u\n", rw == UIO_READ ? "read" : "write",
+	      bufs[0]->b_block, n);
+
+	bi = kmalloc(sizeof(*bi));
+	if (bi == NULL) {
+		return ENOMEM;
+	}
+	for (i = 0; i < n; i++) {
+		KASSERT(bufs[i]->b_dev == bufs[0]->b_dev);
+		KASSERT(bufs[i]->b_block == bufs[0]->b_block + i);
+		KASSERT(!bufs[i]->b_busy);
+		bufqueue_remove(bufs[i]);
+		bufs[i]->b_refcount++;
+		bufs[i]->b_busy = true;
+		bufs[i]->b_io = bi;
+		bi->bi_bufs[i] = bufs[i];
+	}
+	bi->bi_num = n;
+	bi->bi_bio.bio_rw = rw;
+	bi->bi_async = async;
+	bi->bi_next = NULL;
+	if (async) {
+		buffer_nasync++;
+	}
+
+	buffer_submit(bi);
+	*ret = bi;
+	return 0;
+}
+
+/*
+ * Wait for an I/O to come back from the device.
+ */
+static
+void
+buffer_iosleep(struct bufio *bi)
+{
+	spinlock_acquire(&buffer_iolock);
+	while (!bi->bi_done) {
+		wchan_sleep(buffer_iowchan, &buffer_iolock);
+	}
+	spinlock_release(&buffer_iolock);
+}
+
+/*
+ * Apply the result of a finished I/O to its buffers, let go of them,
+ * and get rid of it.
+ */
+static
+int
+buffer_iofinish(struct bufio *bi)
+{
+	struct buf *b;
+	unsigned i;
+	int result;
+
+	result = bi->bi_bio.bio_error;
+	if (result == EINVAL) {
+		/*
+		 * This means the sector we requested was out of range,
+		 * or the seek address we gave wasn't sector-aligned,
+		 * or a couple of other things that are our fault.
+		 */
+		panic("buffer: device I/O returned EINVAL\n");
+	}
+
+	for (i = 0; i < bi->bi_num; i++) {
+		b = bi->bi_bufs[i];
+		KASSERT(b->b_busy && b->b_io == bi);
+		if (result == 0) {
+			if (bi->bi_bio.bio_rw == UIO_READ) {
+				b->b_valid = true;
+				b->b_prefetched = bi->bi_async;
+			}
+			else if (b->b_dirty) {
+				b->b_dirty = false;
+				buffer_ndirty--;
+			}
+		}
+		b->b_busy = false;
+		b->b_io = NULL;
+		buffer_release(b);
+	}
+
+	kfree(bi);
+	return result;
+}
+
+/*
+ * Wait for and finish a synchronous I/O, retrying I/O errors.
+ */
+static
+int
+buffer_iowait(struct bufio *bi)
+{
+	daddr_t block = bi->bi_bufs[0]->b_block;
+	int tries = 0;
+
+	KASSERT(!bi->bi_async);
+
+	while (1) {
+		buffer_iosleep(bi);
+		if (bi->bi_bio.bio_error != EIO) {
+			break;
+		}
+		if (tries == 0) {
+			kprintf("buffer: block %u I/O error, retrying\n",
+				block);
+		}
+		else if (tries == 10) {
+			kprintf("buffer: block %u I/O error, giving up after "
+				"%d retries\n", block, tries);
+			break;
+		}
+		tries++;
+		buffer_submit(bi);
+	}
+	return buffer_iofinish(bi);
+}
+
+/*
+ * Read or write the blocks of N buffers in one I/O, and wait for it.
+ */
+static
+int
+buffer_io(struct buf **bufs, unsigned n, enum uio_rw rw)
+{
+	struct bufio *bi;
+	int result;
+
+	result = buffer_iostart(bufs, n, rw, false, &bi);
+	if (result) {
+		return result;
+	}
+	return buffer_iowait(bi);
+}
+
+/*
+ * Finish off whatever asynchronous I/O has come back. Errors are
+ * dropped; it was only read-ahead.
+ */
+static
+void
+buffer_reap(void)
+{
+	struct bufio *bi, *next;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	spinlock_acquire(&buffer_iolock);
+	bi = buffer_iodone;
+	buffer_iodone = NULL;
+	spinlock_release(&buffer_iolock);
+
+	for (; bi != NULL; bi = next) {
+		next = bi->bi_next;
+		KASSERT(buffer_nasync > 0);
+		buffer_nasync--;
+		(void)buffer_iofinish(bi);
+	}
+}
+
+/*
+ * Write back N dirty buffers of consecutive blocks.
+ */
+static
+int
+buffer_writeout(struct buf **bufs, unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		KASSERT(bufs[i]->b_valid && bufs[i]->b_dirty);
+	}
+
+	return buffer_io(bufs, n, UIO_WRITE);
+}
+
+/*
+ * Order buffers by device, then block.
+ */
+static
+bool
+buffer_before(struct buf *a, struct buf *b)
+{
+	if (a->b_dev != b->b_dev) {
+		return (uintptr_t)a->b_dev < (uintptr_t)b->b_dev;
+	}
+	return a->b_block < b->b_block;
+}
+
+/*
+ * Write back dirty buffers of DEV (of every device, if DEV is NULL)
+ * until no more than TARGET are dirty, going up the disk in block
+ * order and writing each run of adjacent blocks in one I/O. The
+ * writes are all handed to the device before waiting for any, so it
+ * always has the next one queued. Keeps going past errors and returns
+ * the first.
+ */
+static
+int
+buffer_flush(struct device *dev, unsigned target)
+{
+	struct buf **bufs, *b;
+	struct bufio **ios;
+	unsigned num, nios, left, i, j, run;
+	int result, ret = 0;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (buffer_ndirty <= target || buffer_flushing) {
+		return 0;
+	}
+
+	bufs = kmalloc(buffer_ndirty * sizeof(*bufs));
+	ios = kmalloc(buffer_ndirty * sizeof(*ios));
+	if (bufs == NULL || ios == NULL) {
+		kfree(bufs);
+		kfree(ios);
+		return ENOMEM;
+	}
+	buffer_flushing = true;
+
+	/* Gather them up, in order (insertion sort; there aren't many) */
+	num = 0;
+	for (i = 0; i < BUFFER_HASHSIZE; i++) {
+		for (b = buffer_hash[i]; b != NULL; b = b->b_hashnext) {
+			if (!b->b_dirty || (dev != NULL && b->b_dev != dev)) {
+				continue;
+			}
+			KASSERT(num < buffer_ndirty);
+			for (j = num; j > 0 && buffer_before(b, bufs[j-1]); j--) {
+				bufs[j] = bufs[j-1];
+			}
+			bufs[j] = b;
+			num++;
+		}
+	}
+
+	nios = 0;
+	left = buffer_ndirty;
+	for (i = 0; i < num && left > target; i += run) {
+		run = 1;
+		while (i + run < num && run < BUFFER_BATCH &&
+		       bufs[i + run]->b_dev == bufs[i]->b_dev &&
+		       bufs[i + run]->b_block == bufs[i]->b_block + run) {
+			run++;
+		}
+		result = buffer_iostart(&bufs[i], run, UIO_WRITE, false,
+					&ios[nios]);
+		if (result) {
+			if (ret == 0) {
+				ret = result;
+			}
+			continue;
+		}
+		nios++;
+		left -= run;
+	}
+
+	for (i = 0; i < nios; i++) {
+		result = buffer_iowait(ios[i]);
+		if (result && ret == 0) {
+			ret = result;
+		}
+	}
+
+	buffer_flushing = false;
+	kfree(ios);
+	kfree(bufs);
+	return ret;
+}
+
+/*
+ * Look up BLOCK of DEV; if it's still being read ahead, wait for that
+ * to finish first.
+ */
+static
+struct buf *
+buffer_lookup_idle(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	buffer_reap();
+	while ((b = buffer_lookup(dev, block)) != NULL && b->b_busy) {
+		KASSERT(b->b_io->bi_async);
+		buffer_iosleep(b->b_io);
+		buffer_reap();
+	}
+	return b;
+}
+
+////////////////////////////////////////////////////////////
+// Finding buffers
+
+/*
+ * Make a new buffer, holding nothing and on no queue.
+ */
+static
+struct buf *
+buffer_create(void)
+{
+	struct buf *b;
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+	b->b_data = kmalloc(BUFFER_SIZE);
+	if (b->b_data == NULL) {
+		kfree(b);
+		return NULL;
+	}
+	b->b_dev = NULL;
+	b->b_block = 0;
+	b->b_refcount = 0;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_reused = false;
+	b->b_prefetched = false;
+	b->b_busy = false;
+	b->b_io = NULL;
+	b->b_queue = BQ_NONE;
+	b->b_hashnext = NULL;
+	b->b_prev = b->b_next = NULL;
+
+	buffer_total++;
+	return b;
+}
+
+/*
+ * Find a buffer to put a new block in: a free one, a new one while the
+ * cache is still growing, or else the oldest one on the probationary
+ * queue (while that's over its share) or the LRU queue. A dirty victim
+ * is written back first. Hands back a buffer holding nothing.
+ */
+static
+int
+buffer_getfresh(struct buf **ret)
+{
+	struct buf *b;
+	unsigned q;
+	int result;
+
+	b = buffer_queues[BQ_FREE].bq_head;
+	if (b == NULL && buffer_total < BUFFER_MAX) {
+		b = buffer_create();
+	}
+	if (b == NULL) {
+		if (buffer_queues[BQ_PROBATION].bq_num > BUFFER_PROBATION_MAX ||
+		    buffer_queues[BQ_LRU].bq_num == 0) {
+			q = BQ_PROBATION;
+		}
+		else {
+			q = BQ_LRU;
+		}
+		b = buffer_queues[q].bq_head;
+	}
+	if (b == NULL) {
+		/* Everything is in use; better to go over than to fail */
+		b = buffer_create();
+		if (b == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	if (b->b_dirty) {
+		/* On failure it stays cached and dirty, as it was */
+		result = buffer_writeout(&b, 1);
+		if (result) {
+			return result;
+		}
+	}
+
+	bufqueue_remove(b);
+	buffer_forget(b);
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Find BLOCK of DEV in the cache, or set aside a buffer for it, and
+ * take a reference.
+ */
+static
+int
+buffer_find(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	b = buffer_lookup_idle(dev, block);
+	if (b != NULL) {
+		/*
+		 * Only a fresh use counts, not a nested one; and the
+		 * first use of a block read ahead is its first real one.
+		 */
+		if (b->b_refcount == 0) {
+			if (b->b_prefetched) {
+				b->b_prefetched = false;
+			}
+			else {
+				b->b_reused = true;
+			}
+		}
+	}
+	else {
+		result = buffer_getfresh(&b);
+		if (result) {
+			return result;
+		}
+		buffer_assign(b, dev, block);
+	}
+
+	bufqueue_remove(b);
+	b->b_refcount++;
+	*ret = b;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+int
+buffer_read(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	result = buffer_find(dev, block, &b);
+	if (result) {
+		return result;
+	}
+
+	if (!b->b_valid) {
+		result = buffer_io(&b, 1, UIO_READ);
+		if (result) {
+			buffer_release(b);
+			return result;
+		}
+	}
+
+	*ret = b;
+	return 0;
+}
+
+int
+buffer_get(struct device *dev, daddr_t block, struct buf **ret)
+{
+	return buffer_find(dev, block, ret);
+}
+
+void *
+buffer_map(struct buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	return b->b_data;
+}
+
+bool
+buffer_valid(struct buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	return b->b_valid;
+}
+
+void
+buffer_mark_dirty(struct buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	KASSERT(b->b_dev != NULL);
+
+	if (!b->b_dirty) {
+		buffer_ndirty++;
+	}
+	b->b_valid = true;
+	b->b_dirty = true;
+}
+
+void
+buffer_release(struct buf *b)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(b->b_refcount > 0);
+	KASSERT(b->b_queue == BQ_NONE);
+
+	b->b_refcount--;
+	if (b->b_refcount > 0) {
+		return;
+	}
+
+	if (!b->b_valid) {
+		/* Never filled in, or dropped while in use */
+		buffer_forget(b);
+		bufqueue_append(BQ_FREE, b);
+	}
+	else {
+		bufqueue_append(b->b_reused ? BQ_LRU : BQ_PROBATION, b);
+	}
+
+	/*
+	 * Past the high-water mark, the writer pays for writing some
+	 * back. Errors stay with the buffers, which stay dirty.
+	 */
+	if (buffer_ndirty > BUFFER_DIRTY_HIGH && !buffer_flushing) {
+		(void)buffer_flush(NULL, BUFFER_DIRTY_LOW);
+	}
+}
+
+void
+buffer_drop(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	b = buffer_lookup_idle(dev, block);
+	if (b == NULL) {
+		return;
+	}
+	buffer_forget(b);
+	if (b->b_refcount == 0) {
+		bufqueue_remove(b);
+		bufqueue_append(BQ_FREE, b);
+	}
+}
+
+/*
+ * Write back every dirty buffer of DEV, or of every device if DEV is
+ * NULL.
+ */
+int
+buffer_sync(struct device *dev)
+{
+	return buffer_flush(dev, 0);
+}
+
+/*
+ * Write back and forget everything cached for DEV, for unmount. None
+ * of it may be in use.
+ */
+int
+buffer_drop_device(struct device *dev)
+{
+	struct buf *b, *next;
+	unsigned i;
+	int result;
+
+	/* Let read-ahead in flight land first */
+	buffer_reap();
+	while (buffer_nasync > 0) {
+		spinlock_acquire(&buffer_iolock);
+		while (buffer_iodone == NULL) {
+			wchan_sleep(buffer_iowchan, &buffer_iolock);
+		}
+		spinlock_release(&buffer_iolock);
+		buffer_reap();
+	}
+
+	result = buffer_sync(dev);
+	if (result) {
+		return result;
+	}
+
+	for (i = 0; i < BUFFER_HASHSIZE; i++) {
+		for (b = buffer_hash[i]; b != NULL; b = next) {
+			next = b->b_hashnext;
+			if (b->b_dev != dev) {
+				continue;
+			}
+			KASSERT(b->b_refcount == 0);
+			bufqueue_remove(b);
+			buffer_forget(b);
+			bufqueue_append(BQ_FREE, b);
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Read-ahead
+
+/*
+ * Start reading BLOCK of DEV into the cache, and don't wait for it.
+ * Just a hint: ignored if the block is already cached or too many
+ * reads are in flight.
+ */
+void
+buffer_readahead(struct device *dev, daddr_t block)
+{
+	struct bufio *bi;
+	struct buf *b;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	buffer_reap();
+
+	if (buffer_nasync >= BUFFER_RAMAX ||
+	    buffer_lookup(dev, block) != NULL) {
+		return;
+	}
+
+	if (buffer_find(dev, block, &b)) {
+		return;
+	}
+	/* The I/O holds it now; on failure, releasing it forgets it */
+	(void)buffer_iostart(&b, 1, UIO_READ, true, &bi);
+	buffer_release(b);
+}
+
+////////////////////////////////////////////////////////////
+// Syncer
+
+/*
+ * The syncer thread. Syncs every filesystem now and then, so nothing
+ * stays only in memory for long: the filesystems write their own
+ * dirty metadata into the cache, then have it all written back.
+ */
+static
+void
+buffer_syncer(void *unused1, unsigned long unused2)
+{
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(BUFFER_SYNC_INTERVAL);
+		vfs_sync();
+	}
+}
+
+void
+buffer_bootstrap(void)
+{
+	int result;
+
+	buffer_iowchan = wchan_create("buffer I/O");
+	if (buffer_iowchan == NULL) {
+		panic("buffer: Could not create I/O wait channel\n");
+	}
+
+	result = thread_fork("syncer", NULL, buffer_syncer, NULL, 0);
+	if (result) {
+		panic("buffer: Could not start syncer thread: %s\n",
+		      strerror(result));
+	}
+}
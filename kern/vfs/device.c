@@ -42,6 +42,7 @@
 #include <synch.h>
 #include <vnode.h>
 #include <device.h>
+#include <kern/poll.h>
 
 /*
  * Called for each open().
@@ -289,6 +290,22 @@ dev_namefile(struct vnode *v, struct uio *uio)
 	return 0;
 }
 
+/*
+ * For poll and select. Devices that can block say when they're ready;
+ * the rest are always ready.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct pollent *pe)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_ops->devop_poll == NULL) {
+		return events & (POLLIN | POLLOUT);
+	}
+	return DEVOP_POLL(d, events, pe);
+}
+
 /*
  * Name lookup.
  *
@@ -338,6 +355,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
 	.vop_namefile = dev_namefile,
+	.vop_poll = dev_poll,
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
 	.vop_mkdir = vopfail_mkdir_notdir,
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes: a ring buffer with a vnode for each end. See pipe.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <kern/poll.h>
+#include <poll.h>
+#include <pipe.h>
+
+struct pipe {
+	struct lock *pp_lock;		/* everything below */
+	struct cv *pp_readcv;		/* readers wait here for data */
+	struct cv *pp_writecv;		/* writers wait here for space */
+
+	char *pp_buf;
+	size_t pp_size;			/* bytes in pp_buf */
+	size_t pp_head;			/* next byte to read */
+	size_t pp_count;		/* bytes waiting to be read */
+
+	bool pp_readopen;		/* read end still open */
+	bool pp_writeopen;		/* write end still open */
+	struct pollq pp_pollq;		/* pollers of either end */
+
+	struct vnode pp_readvn;
+	struct vnode pp_writevn;
+};
+
+static
+void
+pipe_destroy(struct pipe *pp)
+{
+	pollq_cleanup(&pp->pp_pollq);
+	if (pp->pp_writecv != NULL) {
+		cv_destroy(pp->pp_writecv);
+	}
+	if (pp->pp_readcv != NULL) {
+		cv_destroy(pp->pp_readcv);
+	}
+	if (pp->pp_lock != NULL) {
+		lock_destroy(pp->pp_lock);
+	}
+	kfree(pp->pp_buf);
+	kfree(pp);
+}
+
+/*
+ * Move up to LEN bytes between the ring and UIO, starting POS bytes
+ * past the head. Does at most two uiomoves, one per side of the wrap,
+ * straight between the caller's buffer and the ring.
+ */
+static
+int
+pipe_uiomove(struct pipe *pp, size_t pos, size_t len, struct uio *uio)
+{
+	size_t start, chunk;
+	int result;
+
+	while (len > 0) {
+		start = (pp->pp_head + pos) % pp->pp_size;
+		chunk = pp->pp_size - start;
+		if (chunk > len) {
+			chunk = len;
+		}
+		result = uiomove(pp->pp_buf + start, chunk, uio);
+		if (result) {
+			return result;
+		}
+		pos += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * Called for each open(). Pipe ends can't be opened by name, so this
+ * never happens.
+ */
+static
+int
+pipe_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return EINVAL;
+}
+
+/*
+ * Last reference to one end is gone: wake anyone on the other end so
+ * they see EOF or EPIPE, and free the pipe once both ends are closed.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *pp = v->vn_data;
+	bool gone;
+
+	/* Nobody else can reach this end now; the other may free pp */
+	vnode_cleanup(v);
+
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_readvn) {
+		pp->pp_readopen = false;
+		cv_broadcast(pp->pp_writecv, pp->pp_lock);
+		pollq_wakeup(&pp->pp_pollq);
+	}
+	else {
+		KASSERT(v == &pp->pp_writevn);
+		pp->pp_writeopen = false;
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+		pollq_wakeup(&pp->pp_pollq);
+	}
+	gone = !pp->pp_readopen && !pp->pp_writeopen;
+	lock_release(pp->pp_lock);
+
+	if (gone) {
+		pipe_destroy(pp);
+	}
+	return 0;
+}
+
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t len;
+	int result;
+
+	if (v != &pp->pp_readvn) {
+		return EBADF;
+	}
+
+	lock_acquire(pp->pp_lock);
+	while (pp->pp_count == 0 && pp->pp_writeopen) {
+		cv_wait(pp->pp_readcv, pp->pp_lock);
+	}
+
+	/* Empty with no writer is EOF: leave the uio alone */
+	len = pp->pp_count;
+	if (len > uio->uio_resid) {
+		len = uio->uio_resid;
+	}
+	result = pipe_uiomove(pp, 0, len, uio);
+	if (result == 0) {
+		pp->pp_head = (pp->pp_head + len) % pp->pp_size;
+		pp->pp_count -= len;
+		if (len > 0) {
+			cv_broadcast(pp->pp_writecv, pp->pp_lock);
+			pollq_wakeup(&pp->pp_pollq);
+		}
+	}
+	lock_release(pp->pp_lock);
+
+	return result;
+}
+
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t space, len;
+	size_t want, start;
+	int result = 0;
+
+	if (v != &pp->pp_writevn) {
+		return EBADF;
+	}
+
+	/* Small writes go in whole, so they don't interleave */
+	start = uio->uio_resid;
+	want = start <= PIPE_BUF ? start : 1;
+
+	lock_acquire(pp->pp_lock);
+	while (uio->uio_resid > 0) {
+		while (pp->pp_readopen &&
+		       pp->pp_size - pp->pp_count < want) {
+			cv_wait(pp->pp_writecv, pp->pp_lock);
+		}
+		if (!pp->pp_readopen) {
+			/* Report what got through, if anything did */
+			result = uio->uio_resid < start ? 0 : EPIPE;
+			break;
+		}
+
+		space = pp->pp_size - pp->pp_count;
+		len = uio->uio_resid < space ? uio->uio_resid : space;
+		result = pipe_uiomove(pp, pp->pp_count, len, uio);
+		if (result) {
+			break;
+		}
+		pp->pp_count += len;
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+		pollq_wakeup(&pp->pp_pollq);
+		want = 1;
+	}
+	lock_release(pp->pp_lock);
+
+	return result;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+/*
+ * Called for stat(). The size is what's waiting to be read.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *pp = v->vn_data;
+	int result;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	result = VOP_GETTYPE(v, &statbuf->st_mode);
+	if (result) {
+		return result;
+	}
+	statbuf->st_mode |= 0600;
+	statbuf->st_nlink = 1;
+
+	lock_acquire(pp->pp_lock);
+	statbuf->st_size = pp->pp_count;
+	lock_release(pp->pp_lock);
+
+	return 0;
+}
+
+/*
+ * The read end is readable when there's data or the writer is gone
+ * (read returns EOF); the write end is writable when PIPE_BUF bytes
+ * fit, and in error once the reader is gone.
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct pollent *pe)
+{
+	struct pipe *pp = v->vn_data;
+	int revents = 0;
+
+	/* Register before looking, so a change right after still wakes */
+	if (pe != NULL) {
+		pollq_register(&pp->pp_pollq, pe);
+	}
+
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_readvn) {
+		if (pp->pp_count > 0 || !pp->pp_writeopen) {
+			revents |= events & POLLIN;
+		}
+		if (!pp->pp_writeopen) {
+			revents |= POLLHUP;
+		}
+	}
+	else {
+		if (!pp->pp_readopen) {
+			revents |= POLLERR;
+		}
+		else if (pp->pp_size - pp->pp_count >= PIPE_BUF) {
+			revents |= events & POLLOUT;
+		}
+	}
+	lock_release(pp->pp_lock);
+
+	return revents;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_namefile(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return ENOTDIR;
+}
+
+/*
+ * Function table for pipe vnodes.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_perm,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = pipe_namefile,
+	.vop_poll = pipe_poll,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+int
+pipe_create(size_t bufsize, struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *pp;
+
+	KASSERT(bufsize >= PIPE_BUF);
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pollq_init(&pp->pp_pollq);
+	pp->pp_buf = kmalloc(bufsize);
+	pp->pp_lock = lock_create("pipe");
+	pp->pp_readcv = cv_create("pipe read");
+	pp->pp_writecv = cv_create("pipe write");
+	if (pp->pp_buf == NULL || pp->pp_lock == NULL ||
+	    pp->pp_readcv == NULL || pp->pp_writecv == NULL) {
+		pipe_destroy(pp);
+		return ENOMEM;
+	}
+
+	pp->pp_size = bufsize;
+	pp->pp_head = 0;
+	pp->pp_count = 0;
+	pp->pp_readopen = true;
+	pp->pp_writeopen = true;
+
+	vnode_init(&pp->pp_readvn, &pipe_vnode_ops, NULL, pp);
+	vnode_init(&pp->pp_writevn, &pipe_vnode_ops, NULL, pp);
+
+	*readend = &pp->pp_readvn;
+	*writeend = &pp->pp_writevn;
+	return 0;
+}
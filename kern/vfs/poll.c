@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Poll queues and waiters. See poll.h.
+ *
+ * Lock order: poll_timelock, then a pollq's pq_lock, then a waiter's
+ * pw_lock. A waiter never holds its pw_lock while taking a pq_lock.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <wchan.h>
+#include <poll.h>
+
+/* Waiters with a deadline, checked from hardclock */
+static struct spinlock poll_timelock = SPINLOCK_INITIALIZER;
+static struct pollwaiter *poll_timed;
+
+void
+pollq_init(struct pollq *pq)
+{
+	spinlock_init(&pq->pq_lock);
+	pq->pq_head = NULL;
+}
+
+void
+pollq_cleanup(struct pollq *pq)
+{
+	KASSERT(pq->pq_head == NULL);
+	spinlock_cleanup(&pq->pq_lock);
+}
+
+void
+pollq_register(struct pollq *pq, struct pollent *pe)
+{
+	KASSERT(pe->pe_q == NULL);
+
+	spinlock_acquire(&pq->pq_lock);
+	pe->pe_q = pq;
+	pe->pe_next = pq->pq_head;
+	pq->pq_head = pe;
+	spinlock_release(&pq->pq_lock);
+}
+
+/*
+ * Wake every waiter registered on PQ. They stay registered; each
+ * rescans and goes back to sleep if what it wants still isn't ready.
+ */
+void
+pollq_wakeup(struct pollq *pq)
+{
+	struct pollent *pe;
+	struct pollwaiter *pw;
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pe = pq->pq_head; pe != NULL; pe = pe->pe_next) {
+		pw = pe->pe_waiter;
+		spinlock_acquire(&pw->pw_lock);
+		pw->pw_woken = true;
+		wchan_wakeall(pw->pw_wchan, &pw->pw_lock);
+		spinlock_release(&pw->pw_lock);
+	}
+	spinlock_release(&pq->pq_lock);
+}
+
+void
+pollent_init(struct pollent *pe, struct pollwaiter *pw)
+{
+	pe->pe_waiter = pw;
+	pe->pe_q = NULL;
+	pe->pe_next = NULL;
+}
+
+void
+pollent_unregister(struct pollent *pe)
+{
+	struct pollq *pq = pe->pe_q;
+	struct pollent **pp;
+
+	if (pq == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pp = &pq->pq_head; *pp != pe; pp = &(*pp)->pe_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = pe->pe_next;
+	spinlock_release(&pq->pq_lock);
+
+	pe->pe_q = NULL;
+	pe->pe_next = NULL;
+}
+
+int
+pollwaiter_init(struct pollwaiter *pw, int timeout_ms)
+{
+	struct timespec delta;
+
+	pw->pw_wchan = wchan_create("poll");
+	if (pw->pw_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&pw->pw_lock);
+	pw->pw_woken = false;
+	pw->pw_timedout = false;
+	pw->pw_timed = timeout_ms >= 0;
+	pw->pw_timenext = NULL;
+
+	if (pw->pw_timed) {
+		delta.tv_sec = timeout_ms / 1000;
+		delta.tv_nsec = (timeout_ms % 1000) * 1000000;
+		gettime(&pw->pw_deadline);
+		timespec_add(&pw->pw_deadline, &delta, &pw->pw_deadline);
+
+		spinlock_acquire(&poll_timelock);
+		pw->pw_timenext = poll_timed;
+		poll_timed = pw;
+		spinlock_release(&poll_timelock);
+	}
+	return 0;
+}
+
+/*
+ * Every pollent of PW must already be unregistered.
+ */
+void
+pollwaiter_cleanup(struct pollwaiter *pw)
+{
+	struct pollwaiter **pp;
+
+	if (pw->pw_timed) {
+		spinlock_acquire(&poll_timelock);
+		for (pp = &poll_timed; *pp != pw; pp = &(*pp)->pw_timenext) {
+			KASSERT(*pp != NULL);
+		}
+		*pp = pw->pw_timenext;
+		spinlock_release(&poll_timelock);
+	}
+
+	spinlock_cleanup(&pw->pw_lock);
+	wchan_destroy(pw->pw_wchan);
+}
+
+void
+pollwaiter_reset(struct pollwaiter *pw)
+{
+	spinlock_acquire(&pw->pw_lock);
+	pw->pw_woken = false;
+	spinlock_release(&pw->pw_lock);
+}
+
+bool
+pollwaiter_sleep(struct pollwaiter *pw)
+{
+	bool timedout;
+
+	spinlock_acquire(&pw->pw_lock);
+	while (!pw->pw_woken && !pw->pw_timedout) {
+		wchan_sleep(pw->pw_wchan, &pw->pw_lock);
+	}
+	timedout = pw->pw_timedout;
+	spinlock_release(&pw->pw_lock);
+
+	return !timedout;
+}
+
+void
+poll_hardclock(void)
+{
+	struct pollwaiter *pw;
+	struct timespec now;
+
+	/* Unlocked peek: nearly always nobody is waiting with a timeout */
+	if (poll_timed == NULL) {
+		return;
+	}
+
+	gettime(&now);
+	spinlock_acquire(&poll_timelock);
+	for (pw = poll_timed; pw != NULL; pw = pw->pw_timenext) {
+		if (pw->pw_timedout) {
+			continue;
+		}
+		if (now.tv_sec < pw->pw_deadline.tv_sec ||
+		    (now.tv_sec == pw->pw_deadline.tv_sec &&
+		     now.tv_nsec < pw->pw_deadline.tv_nsec)) {
+			continue;
+		}
+		spinlock_acquire(&pw->pw_lock);
+		pw->pw_timedout = true;
+		wchan_wakeall(pw->pw_wchan, &pw->pw_lock);
+		spinlock_release(&pw->pw_lock);
+	}
+	spinlock_release(&poll_timelock);
+}
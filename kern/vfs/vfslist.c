@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <buf.h>
 
 /*
  * Structure for a single named device.
@@ -111,6 +112,7 @@ vfs_bootstrap(void)
 
 	devnull_create();
 	semfs_bootstrap();
+	buffer_bootstrap();
 }
 
 /*
@@ -37,6 +37,7 @@
 #include <vfs.h>
 #include <vnode.h>
 #include <device.h>
+#include <kern/poll.h>
 /*
  * Initialize an abstract vnode.
  */
@@ -186,3 +187,14 @@ vnode_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
  }
  
 
+/*
+ * VOP_POLL for objects that never block (regular files, directories):
+ * always ready, so there is nothing to register for.
+ */
+int
+vopnull_poll(struct vnode *vn, int events, struct pollent *pe)
+{
+	(void)vn;
+	(void)pe;
+	return events & (POLLIN | POLLOUT);
+}
@@ -166,7 +166,7 @@ struct pageref {
  * OS/161 performance and scalability aren't super-critical.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER_NAMED("kmalloc");
 
 ////////////////////////////////////////
 
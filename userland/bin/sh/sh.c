@@ -69,6 +69,9 @@ struct exitinfo {
 /* set to nonzero if __time syscall seems to work */
 static int timing = 0;
 
+/* most commands in one pipeline */
+#define MAXPIPE 16
+
 /* array of backgrounded jobs (allows "foregrounding") */
 #define MAXBG 128
 static pid_t bgpids[MAXBG];
@@ -355,12 +358,108 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * dopipeline
+ * runs "cmd | cmd | ..." in the foreground. each command's output is
+ * connected to the next one's input with a pipe. args is split in
+ * place at the "|"s. the exit status is that of the last command.
+ */
+static
+void
+dopipeline(char **args, int nargs, struct exitinfo *ei)
+{
+	char **cmds[MAXPIPE];
+	pid_t pids[MAXPIPE];
+	int ncmds, nstarted, i, status;
+	int infd, fds[2];
+
+	ncmds = 0;
+	cmds[ncmds++] = args;
+	for (i=0; i<nargs; i++) {
+		if (strcmp(args[i], "|")) {
+			continue;
+		}
+		if (ncmds >= MAXPIPE) {
+			printf("Too many commands in pipeline\n");
+			exitinfo_exit(ei, 1);
+			return;
+		}
+		args[i] = NULL;
+		cmds[ncmds++] = &args[i+1];
+	}
+	for (i=0; i<ncmds; i++) {
+		if (cmds[i][0] == NULL) {
+			printf("Invalid null command in pipeline\n");
+			exitinfo_exit(ei, 1);
+			return;
+		}
+	}
+
+	exitinfo_exit(ei, 0);
+	infd = STDIN_FILENO;
+	for (nstarted=0; nstarted<ncmds; nstarted++) {
+		fds[0] = -1;
+		fds[1] = STDOUT_FILENO;
+		if (nstarted < ncmds-1 && pipe(fds) < 0) {
+			warn("pipe");
+			exitinfo_exit(ei, 255);
+			break;
+		}
+
+		pids[nstarted] = vfork();
+		if (pids[nstarted] == 0) {
+			/* child: hook up stdin/stdout, then exec */
+			if (infd != STDIN_FILENO) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (fds[1] != STDOUT_FILENO) {
+				dup2(fds[1], STDOUT_FILENO);
+				close(fds[1]);
+				close(fds[0]);
+			}
+			execvp(cmds[nstarted][0], cmds[nstarted]);
+			warn("%s", cmds[nstarted][0]);
+			_exit(1);
+		}
+
+		/* parent: the children hold the pipe ends now */
+		if (infd != STDIN_FILENO) {
+			close(infd);
+		}
+		if (fds[1] != STDOUT_FILENO) {
+			close(fds[1]);
+		}
+		infd = fds[0];
+
+		if (pids[nstarted] < 0) {
+			warn("vfork");
+			exitinfo_exit(ei, 255);
+			break;
+		}
+	}
+	if (infd >= 0 && infd != STDIN_FILENO) {
+		close(infd);
+	}
+
+	for (i=0; i<nstarted; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			exitinfo_exit(ei, 255);
+		}
+		else if (i == ncmds-1) {
+			readstatus(status, ei);
+		}
+	}
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
- * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * otherwise, it's a standard command.  a command with '|' in it is run as a
+ * pipeline.  check for the '&', try to background the job if possible,
+ * otherwise just run it and wait on it.
  */
 static
 void
@@ -403,6 +502,13 @@ docommand(char *buf, struct exitinfo *ei)
 
 	/* Not a builtin; run it */
 
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			dopipeline(args, nargs, ei);
+			return;
+		}
+	}
+
 	if (nargs > 0 && !strcmp(args[nargs-1], "&")) {
 		/* background */
 		if (!can_bg()) {
@@ -421,11 +527,16 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
+	/*
+	 * The child only execs (or exits), so vfork: it borrows our
+	 * address space instead of copying it, and we resume once it
+	 * has exec'd.
+	 */
+	pid = vfork();
 	switch (pid) {
 		case -1:
 			/* error */
-			warn("fork");
+			warn("vfork");
 			exitinfo_exit(ei, 255);
 			return;
 		case 0:
@@ -111,7 +111,10 @@
 /* Required. */
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
+int execve(const char *prog, char *const *args, char *const *env);
 pid_t fork(void);
+pid_t vfork(void);
+pid_t spawn(const char *prog, char *const *args, const int *fds, int nfds);
 pid_t waitpid(pid_t pid, int *returncode, int flags);
 /*
  * Open actually takes either two or three args: the optional third
@@ -121,6 +124,9 @@ pid_t waitpid(pid_t pid, int *returncode, int flags);
 int open(const char *filename, int flags, ...);
 ssize_t read(int filehandle, void *buf, size_t size);
 ssize_t write(int filehandle, const void *buf, size_t size);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+/* readv, writev - see sys/uio.h */
 int close(int filehandle);
 int reboot(int code);
 int sync(void);
@@ -148,6 +154,8 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+int setaffinity(pid_t pid, unsigned mask);
+int getaffinity(pid_t pid, unsigned *mask);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
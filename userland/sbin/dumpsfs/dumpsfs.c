@@ -163,6 +163,9 @@ dumpsb(void)
 		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
 	dumpvalf("Block size", "%u bytes", SFS_BLOCKSIZE);
 	dumplval("Volume name", sb.sb_volname);
+	dumpvalf("Features", "0x%x%s", SWAP32(sb.sb_features),
+		 (SWAP32(sb.sb_features) & SFS_FEATURE_EXTENTS) ?
+		 " (extents)" : "");
 
 	for (i=0; i<ARRAYCOUNT(sb.reserved); i++) {
 		if (sb.reserved[i] != 0) {
@@ -255,9 +258,39 @@ dumpindirect(uint32_t block)
 	}
 }
 
+/*
+ * Where FILEBLOCK is, given TREEBLOCK from the direct and indirect
+ * blocks: there, or else in an extent, if any.
+ */
+static
+uint32_t
+mapblock(const struct sfs_dinode *sfi, uint32_t fileblock, uint32_t treeblock)
+{
+	const struct sfs_extent *ext;
+	unsigned i;
+
+	if (treeblock != 0) {
+		return treeblock;
+	}
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sfi->sfi_extents[i];
+		if (SWAP32(ext->sfe_len) == 0) {
+			break;
+		}
+		if (fileblock >= SWAP32(ext->sfe_fileblock) &&
+		    fileblock - SWAP32(ext->sfe_fileblock) <
+		    SWAP32(ext->sfe_len)) {
+			return SWAP32(ext->sfe_diskblock) +
+				(fileblock - SWAP32(ext->sfe_fileblock));
+		}
+	}
+	return 0;
+}
+
 static
 uint32_t
-traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
+traverse_ib(const struct sfs_dinode *sfi, uint32_t fileblock,
+	    uint32_t numblocks, uint32_t block, unsigned levels,
 	    void (*doblock)(uint32_t, uint32_t))
 {
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
@@ -270,7 +303,16 @@ traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
 		diskread(ib, block);
 	}
 	for (i=0; i<ARRAYCOUNT(ib) && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(ib[i]));
+		if (levels > 1) {
+			fileblock = traverse_ib(sfi, fileblock, numblocks,
+						SWAP32(ib[i]), levels-1,
+						doblock);
+		}
+		else {
+			doblock(fileblock, mapblock(sfi, fileblock,
+						    SWAP32(ib[i])));
+			fileblock++;
+		}
 	}
 	return fileblock;
 }
@@ -287,11 +329,21 @@ traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 
 	fileblock = 0;
 	for (i=0; i<SFS_NDIRECT && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(sfi->sfi_direct[i]));
+		doblock(fileblock, mapblock(sfi, fileblock,
+					    SWAP32(sfi->sfi_direct[i])));
+		fileblock++;
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(sfi, fileblock, numblocks,
+					SWAP32(sfi->sfi_indirect), 1, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(sfi, fileblock, numblocks,
+					SWAP32(sfi->sfi_dindirect), 2, doblock);
 	}
 	if (fileblock < numblocks) {
-		fileblock = traverse_ib(fileblock, numblocks,
-					SWAP32(sfi->sfi_indirect), doblock);
+		fileblock = traverse_ib(sfi, fileblock, numblocks,
+					SWAP32(sfi->sfi_tindirect), 3, doblock);
 	}
 	assert(fileblock == numblocks);
 }
@@ -476,6 +528,24 @@ dumpinode(uint32_t ino, const char *name)
 	}
 	printf("    Indirect block: %u (0x%x)\n",
 	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
+	printf("    Double indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_dindirect), SWAP32(sfi.sfi_dindirect));
+	printf("    Triple indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_tindirect), SWAP32(sfi.sfi_tindirect));
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		if (SWAP32(sfi.sfi_extents[i].sfe_len) == 0) {
+			break;
+		}
+		if (i == 0) {
+			printf("    Extents:\n");
+		}
+		printf("        file blocks %u-%u at disk block %u (0x%x)\n",
+		       SWAP32(sfi.sfi_extents[i].sfe_fileblock),
+		       SWAP32(sfi.sfi_extents[i].sfe_fileblock) +
+		       SWAP32(sfi.sfi_extents[i].sfe_len) - 1,
+		       SWAP32(sfi.sfi_extents[i].sfe_diskblock),
+		       SWAP32(sfi.sfi_extents[i].sfe_diskblock));
+	}
 	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
 		if (sfi.sfi_waste[i] != 0) {
 			printf("    Word %u in waste area: 0x%x\n",
@@ -485,6 +555,8 @@ dumpinode(uint32_t ino, const char *name)
 
 	if (doindirect) {
 		dumpindirect(SWAP32(sfi.sfi_indirect));
+		dumpindirect(SWAP32(sfi.sfi_dindirect));
+		dumpindirect(SWAP32(sfi.sfi_tindirect));
 	}
 
 	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR && dodirs) {
@@ -125,7 +125,7 @@ initfreemap(uint32_t fsblocks)
  */
 static
 void
-writesuper(const char *volname, uint32_t nblocks)
+writesuper(const char *volname, uint32_t nblocks, uint32_t features)
 {
 	struct sfs_superblock sb;
 
@@ -139,6 +139,7 @@ writesuper(const char *volname, uint32_t nblocks)
 	/* Initialize the superblock structure */
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
+	sb.sb_features = SWAP32(features);
 	strcpy(sb.sb_volname, volname);
 
 	/* and write it out. */
@@ -189,15 +190,23 @@ writerootdir(void)
 int
 main(int argc, char **argv)
 {
-	uint32_t size, blocksize;
+	uint32_t size, blocksize, features;
 	char *volname, *s;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	/* -e: files map their blocks with extents */
+	features = 0;
+	if (argc==4 && !strcmp(argv[1], "-e")) {
+		features |= SFS_FEATURE_EXTENTS;
+		argc--;
+		argv++;
+	}
+
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-e] device/diskfile volume-name");
 	}
 
 	check();
@@ -230,7 +239,7 @@ main(int argc, char **argv)
 
 	/* Write out the on-disk structures */
 	initfreemap(size);
-	writesuper(volname, size);
+	writesuper(volname, size, features);
 	writefreemap(size);
 	writerootdir();
 
@@ -172,6 +172,99 @@ check_indirect_block(struct ibstate *ibs, uint32_t *ientry, int *iechangedp,
 	}
 }
 
+/*
+ * Check the extents of inode INO, recording blocks that are in use,
+ * dropping any that are past EOF, and clearing any that overlap the
+ * one before or run outside the volume. (Crosslinks with the direct
+ * and indirect blocks show up in freemap.c, as for other blocks.)
+ *
+ * Returns nonzero if SFI has been modified and needs to be written
+ * back.
+ */
+static
+int
+check_inode_extents(struct ibstate *ibs, struct sfs_dinode *sfi)
+{
+	struct sfs_extent *ext;
+	uint32_t nextfree, keep, j;
+	int i, num;
+	int changed = 0;
+
+	if ((sb_features() & SFS_FEATURE_EXTENTS) == 0) {
+		if (checkzeroed(sfi->sfi_extents, sizeof(sfi->sfi_extents))) {
+			warnx("Inode %lu: extents on a volume without them "
+			      "(cleared)", (unsigned long) ibs->ino);
+			setbadness(EXIT_RECOV);
+			bzero(sfi->sfi_extents, sizeof(sfi->sfi_extents));
+			changed = 1;
+		}
+		return changed;
+	}
+
+	nextfree = 0;
+	num = 0;
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sfi->sfi_extents[i];
+		if (ext->sfe_len == 0) {
+			continue;
+		}
+		if (ext->sfe_fileblock < nextfree ||
+		    ext->sfe_diskblock == 0 ||
+		    ext->sfe_diskblock >= ibs->volblocks ||
+		    ext->sfe_len > ibs->volblocks - ext->sfe_diskblock) {
+			setbadness(EXIT_RECOV);
+			warnx("Inode %lu: bad extent %d: file block %lu, "
+			      "disk block %lu, length %lu (cleared)",
+			      (unsigned long) ibs->ino, i,
+			      (unsigned long) ext->sfe_fileblock,
+			      (unsigned long) ext->sfe_diskblock,
+			      (unsigned long) ext->sfe_len);
+			ext->sfe_len = 0;
+			changed = 1;
+			continue;
+		}
+
+		keep = ext->sfe_len;
+		if (ext->sfe_fileblock >= ibs->fileblocks) {
+			keep = 0;
+		}
+		else if (ibs->fileblocks - ext->sfe_fileblock < keep) {
+			keep = ibs->fileblocks - ext->sfe_fileblock;
+		}
+		for (j=0; j<ext->sfe_len; j++) {
+			if (j < keep) {
+				freemap_blockinuse(ext->sfe_diskblock + j,
+						   ibs->usagetype, ibs->ino);
+			}
+			else {
+				ibs->pasteofcount++;
+				freemap_blockfree(ext->sfe_diskblock + j);
+			}
+		}
+		if (keep < ext->sfe_len) {
+			setbadness(EXIT_RECOV);
+			ext->sfe_len = keep;
+			changed = 1;
+		}
+		if (keep == 0) {
+			continue;
+		}
+		nextfree = ext->sfe_fileblock + ext->sfe_len;
+
+		/* Close up any gap left by ones dropped before it */
+		if (num != i) {
+			sfi->sfi_extents[num] = *ext;
+			changed = 1;
+		}
+		num++;
+	}
+	if (changed) {
+		bzero(&sfi->sfi_extents[num],
+		      (SFS_NEXTENTS - num) * sizeof(sfi->sfi_extents[0]));
+	}
+	return changed;
+}
+
 /*
  * Check the blocks belonging to inode INO, whose inode has already
  * been loaded into SFI. ISDIR is a shortcut telling us if the inode
@@ -198,7 +291,7 @@ check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 	ibs.pasteofcount = 0;
 	ibs.usagetype = isdir ? B_DIRDATA : B_DATA;
 
-	changed = 0;
+	changed = check_inode_extents(&ibs, sfi);
 
 	for (ibs.curfileblock=0; ibs.curfileblock<NUM_D; ibs.curfileblock++) {
 		datablock = GET_D(sfi, ibs.curfileblock);
@@ -62,6 +62,7 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_features = SWAP32(sb->sb_features);
 }
 
 static
@@ -97,6 +98,15 @@ swapinode(struct sfs_dinode *sfi)
 	for (i=0; i<NUM_III; i++) {
 		SET_III(sfi, i) = SWAP32(GET_III(sfi, i));
 	}
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		sfi->sfi_extents[i].sfe_fileblock =
+			SWAP32(sfi->sfi_extents[i].sfe_fileblock);
+		sfi->sfi_extents[i].sfe_diskblock =
+			SWAP32(sfi->sfi_extents[i].sfe_diskblock);
+		sfi->sfi_extents[i].sfe_len =
+			SWAP32(sfi->sfi_extents[i].sfe_len);
+	}
 }
 
 static
@@ -155,13 +165,28 @@ ibmap(uint32_t iblock, uint32_t offset, uint32_t entrysize)
 /*
  * bmap() for SFS.
  *
- * Given an inode and a file block, returns a disk block.
+ * Given an inode and a file block, returns a disk block. Extents
+ * come first; on volumes without them they're all zero.
  */
 static
 uint32_t
 bmap(const struct sfs_dinode *sfi, uint32_t fileblock)
 {
+	const struct sfs_extent *ext;
 	uint32_t iblock, offset;
+	int i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sfi->sfi_extents[i];
+		if (ext->sfe_len == 0) {
+			break;
+		}
+		if (fileblock >= ext->sfe_fileblock &&
+		    fileblock - ext->sfe_fileblock < ext->sfe_len) {
+			return ext->sfe_diskblock +
+				(fileblock - ext->sfe_fileblock);
+		}
+	}
 
 	if (fileblock < INOMAX_D) {
 		return GET_D(sfi, fileblock);
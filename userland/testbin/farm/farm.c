@@ -50,19 +50,12 @@ static
 void
 spawnv(const char *prog, char **argv)
 {
-	int pid = fork();
-	switch (pid) {
-	    case -1:
-		err(1, "fork");
-	    case 0:
-		/* child */
-		execv(prog, argv);
+	/* No fork+exec: the kernel builds the child straight from prog */
+	int pid = spawn(prog, argv, NULL, 0);
+	if (pid < 0) {
 		err(1, "%s", prog);
-	    default:
-		/* parent */
-		pids[npids++] = pid;
-		break;
 	}
+	pids[npids++] = pid;
 }
 
 static
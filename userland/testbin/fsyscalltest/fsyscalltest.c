@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <err.h>
 #include <limits.h>
 /*
@@ -155,6 +156,81 @@ test_dup2()
 
 
 
+/*
+ * Gather a header and a payload with writev, scatter them back with
+ * readv, then check pread/pwrite work at their own offset and leave
+ * the file offset alone.
+ */
+static void
+test_vectored()
+{
+	static char hdr[9] = "HEADER:\n";
+	static const char *newhdr = "header:\n";
+	static char payload[41] =
+		"Twiddle dee dee, Twiddle dum dum.......\n";
+	static char rhdr[9], rpayload[41], buf[9];
+	struct iovec iov[2];
+	const char *file;
+	int fd, rv;
+
+	file = "testfile";
+
+	fd = open(file, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd<0) {
+		err(1, "%s: open", file);
+	}
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = 8;
+	iov[1].iov_base = payload;
+	iov[1].iov_len = 40;
+	rv = writev(fd, iov, 2);
+	if (rv != 48) {
+		err(1, "%s: writev returned %d", file, rv);
+	}
+
+	rv = pread(fd, buf, 8, 0);
+	if (rv != 8) {
+		err(1, "%s: pread returned %d", file, rv);
+	}
+	buf[8] = 0;
+	if (strcmp(buf, hdr)) {
+		errx(1, "pread data mismatch!");
+	}
+
+	/* pread must not have moved the offset: we're still at the end */
+	rv = read(fd, buf, 8);
+	if (rv != 0) {
+		errx(1, "%s: read after pread returned %d, expected EOF",
+		     file, rv);
+	}
+
+	rv = pwrite(fd, newhdr, 8, 0);
+	if (rv != 8) {
+		err(1, "%s: pwrite returned %d", file, rv);
+	}
+
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		err(1, "%s: lseek", file);
+	}
+	iov[0].iov_base = rhdr;
+	iov[1].iov_base = rpayload;
+	rv = readv(fd, iov, 2);
+	if (rv != 48) {
+		err(1, "%s: readv returned %d", file, rv);
+	}
+	rhdr[8] = 0;
+	rpayload[40] = 0;
+	if (strcmp(rhdr, newhdr) || strcmp(rpayload, payload)) {
+		errx(1, "readv data mismatch!");
+	}
+
+	rv = close(fd);
+	if (rv<0) {
+		err(1, "%s: close", file);
+	}
+}
+
 static int openFDs[OPEN_MAX-3 + 1];
 
 /*
@@ -368,9 +444,12 @@ main()
 	test_dup2();
 	printf("Passed Part 4 of fsyscalltest\n");
 
-	dir_test();
+	test_vectored();
 	printf("Passed Part 5 of fsyscalltest\n");
 
+	dir_test();
+	printf("Passed Part 6 of fsyscalltest\n");
+
 	printf("All done!\n");
 
 	return 0;
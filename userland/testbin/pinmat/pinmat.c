@@ -0,0 +1,152 @@
+/*
+ * pinmat.c
+ *
+ * Affinity benchmark. Runs one matmult-style job per cpu (or as many
+ * as given on the command line) twice: first letting the scheduler
+ * put and move them wherever it likes, then with each job pinned to
+ * its own cpu with setaffinity(). Prints the wall-clock time of each
+ * round. Pinned jobs don't pay for refilling the cache and TLB every
+ * time they get migrated, so the second round should not be slower.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define Dim	40	/* small enough for several copies to fit at once */
+#define NROUNDS	8	/* multiplications per job */
+
+/* correct answer: sum over i of Dim*i*i */
+#define RIGHT	(Dim * (Dim-1) * Dim * (2*Dim-1) / 6)
+
+#define MAXJOBS	32
+
+static int A[Dim][Dim];
+static int B[Dim][Dim];
+static int C[Dim][Dim];
+static int T[Dim][Dim][Dim];
+
+static
+int
+matmult(void)
+{
+	int i, j, k, r;
+
+	for (i = 0; i < Dim; i++) {
+		for (j = 0; j < Dim; j++) {
+			A[i][j] = i;
+			B[i][j] = j;
+			C[i][j] = 0;
+		}
+	}
+
+	for (i = 0; i < Dim; i++)
+		for (j = 0; j < Dim; j++)
+			for (k = 0; k < Dim; k++)
+				T[i][j][k] = A[i][k] * B[k][j];
+
+	for (i = 0; i < Dim; i++)
+		for (j = 0; j < Dim; j++)
+			for (k = 0; k < Dim; k++)
+				C[i][j] += T[i][j][k];
+
+	r = 0;
+	for (i = 0; i < Dim; i++)
+		r += C[i][i];
+	return r;
+}
+
+static
+void
+job(unsigned cpumask)
+{
+	int n;
+
+	if (cpumask != 0 && setaffinity(0, cpumask) < 0) {
+		err(1, "setaffinity");
+	}
+	for (n = 0; n < NROUNDS; n++) {
+		if (matmult() != RIGHT) {
+			errx(1, "wrong answer");
+		}
+	}
+	_exit(0);
+}
+
+/*
+ * Run NJOBS jobs; if PIN, job i gets the i'th cpu in CPUS (mod the
+ * number of cpus). Returns elapsed time in milliseconds.
+ */
+static
+unsigned long
+runround(int njobs, unsigned cpus, int pin)
+{
+	pid_t pids[MAXJOBS];
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned mask;
+	int i, status, failed;
+
+	__time(&s0, &ns0);
+	mask = cpus;
+	for (i = 0; i < njobs; i++) {
+		if (mask == 0) {
+			mask = cpus;
+		}
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			/* lowest remaining cpu in the mask */
+			job(pin ? (mask & -mask) : 0);
+		}
+		mask &= mask - 1;
+	}
+
+	failed = 0;
+	for (i = 0; i < njobs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (status != 0) {
+			failed = 1;
+		}
+	}
+	__time(&s1, &ns1);
+
+	if (failed) {
+		errx(1, "a job failed");
+	}
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned cpus, m;
+	unsigned long free_ms, pinned_ms;
+	int ncpus, njobs;
+
+	if (getaffinity(0, &cpus) < 0) {
+		err(1, "getaffinity");
+	}
+	ncpus = 0;
+	for (m = cpus; m != 0; m &= m - 1) {
+		ncpus++;
+	}
+
+	njobs = argc > 1 ? atoi(argv[1]) : ncpus;
+	if (njobs < 1 || njobs > MAXJOBS) {
+		errx(1, "Usage: pinmat [1-%d jobs]", MAXJOBS);
+	}
+
+	printf("pinmat: %d jobs on %d cpus\n", njobs, ncpus);
+	free_ms = runround(njobs, cpus, 0);
+	printf("unpinned: %lu ms\n", free_ms);
+	pinned_ms = runround(njobs, cpus, 1);
+	printf("pinned:   %lu ms\n", pinned_ms);
+
+	return 0;
+}
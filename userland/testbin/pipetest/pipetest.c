@@ -0,0 +1,119 @@
+/*
+ * pipetest.c
+ *
+ * Pushes a file several times the size of a pipe through a two-stage
+ * shell pipeline, "cat file | cat", and checks that all of it comes
+ * out the other end intact. The first stage fills the shell's pipe
+ * and blocks writing it while the shell is still closing its own copy
+ * of the write end and starting the second stage; if the blocked write
+ * holds up that close, the pipeline never gets going and this hangs.
+ */
+
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PATH_SH		"/bin/sh"
+#define INFILE		"pipetest.in"
+#define FILESIZE	(16 * 1024)	/* a pipe holds one page */
+
+/* Byte at offset POS of the test file */
+static
+char
+patbyte(unsigned pos)
+{
+	return 'a' + (pos * 7 + pos / 251) % 26;
+}
+
+static
+void
+mkfile(void)
+{
+	char buf[512];
+	unsigned pos, i;
+	int fd;
+
+	fd = open(INFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", INFILE);
+	}
+	for (pos = 0; pos < FILESIZE; pos += sizeof(buf)) {
+		for (i = 0; i < sizeof(buf); i++) {
+			buf[i] = patbyte(pos + i);
+		}
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			err(1, "%s: write", INFILE);
+		}
+	}
+	close(fd);
+}
+
+int
+main(void)
+{
+	char buf[300];
+	const char *args[4];
+	unsigned pos;
+	int fds[2], r, i, status;
+	pid_t pid;
+
+	mkfile();
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		/* child: the shell's output goes into our pipe */
+		close(fds[0]);
+		if (dup2(fds[1], STDOUT_FILENO) < 0) {
+			err(1, "dup2");
+		}
+		close(fds[1]);
+		args[0] = "sh";
+		args[1] = "-c";
+		args[2] = "/bin/cat " INFILE " | /bin/cat";
+		args[3] = NULL;
+		execv(PATH_SH, (char **)args);
+		warn("%s: execv", PATH_SH);
+		_exit(1);
+	}
+	close(fds[1]);
+
+	/* odd-sized reads, so chunks don't line up with the writers' */
+	pos = 0;
+	while ((r = read(fds[0], buf, sizeof(buf))) > 0) {
+		for (i = 0; i < r; i++) {
+			if (buf[i] != patbyte(pos + i)) {
+				errx(1, "byte %u: got %c, expected %c",
+				     pos + i, buf[i], patbyte(pos + i));
+			}
+		}
+		pos += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	close(fds[0]);
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "sh exited abnormally");
+	}
+	if (pos != FILESIZE) {
+		errx(1, "got %u bytes, expected %u", pos, FILESIZE);
+	}
+
+	(void)remove(INFILE);
+	printf("pipetest: %u bytes through cat | cat ok\n", pos);
+	return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * polltest.c
+ *
+ * Tests pipes together with poll and select. Two children each write
+ * a few messages into their own pipe, pausing in between; the parent
+ * sleeps in poll (then select) on both read ends instead of spinning,
+ * and reads whatever becomes ready until both writers hang up. Also
+ * checks that a poll with a timeout on an idle pipe comes back empty.
+ */
+
+#include <sys/select.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+
+#define NWRITERS	2
+#define NMSGS		5
+#define MSGLEN		8
+
+static
+void
+writer(int fd, int id)
+{
+	char msg[MSGLEN];
+	int i;
+	volatile int spin;
+
+	for (i = 0; i < NMSGS; i++) {
+		snprintf(msg, sizeof(msg), "w%d m%d\n", id, i);
+		if (write(fd, msg, MSGLEN) != MSGLEN) {
+			err(1, "writer %d: write", id);
+		}
+		/* give the reader a chance to go back to sleep */
+		for (spin = 0; spin < 100000 * (id + 1); spin++);
+	}
+	_exit(0);
+}
+
+/*
+ * Start the writers; hands back the read end of each one's pipe.
+ */
+static
+void
+start_writers(int *rfds, pid_t *pids)
+{
+	int fds[2];
+	int i;
+
+	for (i = 0; i < NWRITERS; i++) {
+		if (pipe(fds) < 0) {
+			err(1, "pipe");
+		}
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			close(fds[0]);
+			writer(fds[1], i);
+		}
+		close(fds[1]);
+		rfds[i] = fds[0];
+	}
+}
+
+static
+void
+wait_writers(pid_t *pids)
+{
+	int i, status;
+
+	for (i = 0; i < NWRITERS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+}
+
+/*
+ * Read one message from a ready fd. Returns 0 at EOF.
+ */
+static
+int
+drain(int fd)
+{
+	char buf[MSGLEN];
+	int r;
+
+	r = read(fd, buf, MSGLEN);
+	if (r < 0) {
+		err(1, "read");
+	}
+	if (r > 0 && r != MSGLEN) {
+		errx(1, "short read: %d bytes", r);
+	}
+	return r;
+}
+
+static
+void
+test_poll(void)
+{
+	struct pollfd pfds[NWRITERS];
+	int rfds[NWRITERS];
+	pid_t pids[NWRITERS];
+	int i, n, open, got = 0;
+
+	start_writers(rfds, pids);
+	for (i = 0; i < NWRITERS; i++) {
+		pfds[i].fd = rfds[i];
+		pfds[i].events = POLLIN;
+	}
+
+	open = NWRITERS;
+	while (open > 0) {
+		n = poll(pfds, NWRITERS, -1);
+		if (n <= 0) {
+			err(1, "poll returned %d", n);
+		}
+		for (i = 0; i < NWRITERS; i++) {
+			if (pfds[i].revents == 0) {
+				continue;
+			}
+			if (drain(pfds[i].fd) > 0) {
+				got++;
+			}
+			else {
+				/* hung up and empty */
+				close(pfds[i].fd);
+				pfds[i].fd = -1;
+				open--;
+			}
+		}
+	}
+	wait_writers(pids);
+
+	if (got != NWRITERS * NMSGS) {
+		errx(1, "poll: got %d messages, expected %d",
+		     got, NWRITERS * NMSGS);
+	}
+}
+
+static
+void
+test_select(void)
+{
+	fd_set rset;
+	int rfds[NWRITERS];
+	pid_t pids[NWRITERS];
+	int i, n, maxfd, open, got = 0;
+
+	start_writers(rfds, pids);
+
+	open = NWRITERS;
+	while (open > 0) {
+		FD_ZERO(&rset);
+		maxfd = -1;
+		for (i = 0; i < NWRITERS; i++) {
+			if (rfds[i] >= 0) {
+				FD_SET(rfds[i], &rset);
+				if (rfds[i] > maxfd) {
+					maxfd = rfds[i];
+				}
+			}
+		}
+		n = select(maxfd + 1, &rset, NULL, NULL, NULL);
+		if (n <= 0) {
+			err(1, "select returned %d", n);
+		}
+		for (i = 0; i < NWRITERS; i++) {
+			if (rfds[i] < 0 || !FD_ISSET(rfds[i], &rset)) {
+				continue;
+			}
+			if (drain(rfds[i]) > 0) {
+				got++;
+			}
+			else {
+				close(rfds[i]);
+				rfds[i] = -1;
+				open--;
+			}
+		}
+	}
+	wait_writers(pids);
+
+	if (got != NWRITERS * NMSGS) {
+		errx(1, "select: got %d messages, expected %d",
+		     got, NWRITERS * NMSGS);
+	}
+}
+
+static
+void
+test_timeout(void)
+{
+	struct pollfd pfd;
+	int fds[2];
+	int n;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	pfd.fd = fds[0];
+	pfd.events = POLLIN;
+	n = poll(&pfd, 1, 200);
+	if (n != 0) {
+		errx(1, "poll on an idle pipe returned %d", n);
+	}
+
+	/* the write end has room */
+	pfd.fd = fds[1];
+	pfd.events = POLLOUT;
+	n = poll(&pfd, 1, 0);
+	if (n != 1 || !(pfd.revents & POLLOUT)) {
+		errx(1, "pipe write end not writable");
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int
+main(void)
+{
+	test_timeout();
+	printf("polltest: timeout ok\n");
+	test_poll();
+	printf("polltest: poll ok\n");
+	test_select();
+	printf("polltest: select ok\n");
+	return 0;
+}